@@ -0,0 +1,390 @@
+/*
+文件名:CompressedSwap.c
+描述：交换空间前面的压缩交换池。页写交换空间时先压缩放进池里，池满了才把最冷的压缩页写回外存
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "slab.h"
+
+//压缩格式是一串记号：记号字节最高位是0时，后面跟着(记号 + 1)个原样的字节；
+//最高位是1时，表示把前面距离为Distance处的(记号 & 0x7f) + 3个字节复制过来，后面两个字节是Distance，低字节在前
+//匹配用3个字节的哈希表找，只找最近的一处，压缩不求最好，求快
+#define COMPRESS_HASH_BITS 10
+#define COMPRESS_MIN_MATCH 3
+#define COMPRESS_MAX_MATCH (0x7f + COMPRESS_MIN_MATCH)
+#define COMPRESS_MAX_LITERAL 0x80
+
+//压缩页对象的大小分级，最大一级一个slab页还能放2个，压缩数据放不进最大一级的页就不进池
+static const uint CompressedClassSize[COMPRESSED_CLASS_NUM] = {128, 256, 512, 1024, 2032};
+static char *CompressedClassName[COMPRESSED_CLASS_NUM] = {"compressed128", "compressed256", "compressed512", "compressed1024", "compressed2032"};
+#define COMPRESSED_DATA_MAX (2032 - sizeof(struct CompressedPage))
+
+struct
+{
+	//保护链表、区段上的压缩页指针和PoolSize，持有ptable.lock时也会拿，不能睡眠
+	struct spinlock Lock;
+	//压缩和写回时持有，它们共用下面的工作区；写回外存期间也持有，所以同一个槽的外存写不会乱序
+	struct sleeplock WorkLock;
+	//Head是最近放入的页，Tail是最冷的页
+	struct CompressedPage *Head;
+	struct CompressedPage *Tail;
+	uint PoolSize;
+	struct kmemcache Cache[COMPRESSED_CLASS_NUM];
+	ushort HashTable[1 << COMPRESS_HASH_BITS];
+	uchar Buffer[COMPRESSED_DATA_MAX];
+	uchar Page[PGSIZE];
+} CompressedSwap;
+
+void InitializeCompressedSwap(void)
+{
+	int i;
+
+	initlock(&CompressedSwap.Lock, "compressedswap");
+	initsleeplock(&CompressedSwap.WorkLock, "compressedwork");
+	for (i = 0; i < COMPRESSED_CLASS_NUM; i ++)
+	{
+		kmemcacheinit(&CompressedSwap.Cache[i], CompressedClassName[i], CompressedClassSize[i]);
+	}
+}
+
+/*
+描述：把Source里[Start, End)的原样字节写成记号
+参数：原页，开始，结束，目标缓冲区，已写字节数，缓冲区大小
+返回：新的已写字节数，放不下返回-1
+*/
+static int PutLiteral(uchar *Source, int Start, int End, uchar *Destination, int Out, int Limit)
+{
+	int Length;
+
+	for (; Start < End; Start += Length)
+	{
+		Length = End - Start;
+		if (Length > COMPRESS_MAX_LITERAL)
+		{
+			Length = COMPRESS_MAX_LITERAL;
+		}
+		if (Out + 1 + Length > Limit)
+		{
+			return -1;
+		}
+		Destination[Out ++] = Length - 1;
+		memmove(Destination + Out, Source + Start, Length);
+		Out += Length;
+	}
+	return Out;
+}
+
+/*
+描述：压缩一页，调用者持有WorkLock（用工作区的哈希表）
+参数：原页，目标缓冲区，缓冲区大小
+返回：压缩后的字节数，放不进缓冲区返回0
+*/
+static int CompressPage(uchar *Source, uchar *Destination, int Limit)
+{
+	ushort *Table = CompressedSwap.HashTable;
+	int In = 0, Out = 0, LiteralStart = 0, Candidate, Length;
+	uint Hash;
+
+	//表里存位置 + 1，0表示空
+	memset(Table, 0, sizeof(CompressedSwap.HashTable));
+	while (In + COMPRESS_MIN_MATCH <= PGSIZE)
+	{
+		Hash = ((Source[In] << 16) | (Source[In + 1] << 8) | Source[In + 2]) * 2654435761U >> (32 - COMPRESS_HASH_BITS);
+		Candidate = Table[Hash] - 1;
+		Table[Hash] = In + 1;
+		if (Candidate < 0 || Source[Candidate] != Source[In] || Source[Candidate + 1] != Source[In + 1] || Source[Candidate + 2] != Source[In + 2])
+		{
+			In ++;
+			continue;
+		}
+		//匹配可以和当前位置重叠，全0的页每130字节只要一个3字节的记号
+		for (Length = COMPRESS_MIN_MATCH; In + Length < PGSIZE && Length < COMPRESS_MAX_MATCH && Source[Candidate + Length] == Source[In + Length]; Length ++)
+		{
+		}
+		if ((Out = PutLiteral(Source, LiteralStart, In, Destination, Out, Limit)) < 0 || Out + 3 > Limit)
+		{
+			return 0;
+		}
+		Destination[Out ++] = 0x80 | (Length - COMPRESS_MIN_MATCH);
+		Destination[Out ++] = (In - Candidate) & 0xff;
+		Destination[Out ++] = (In - Candidate) >> 8;
+		In += Length;
+		LiteralStart = In;
+	}
+	if ((Out = PutLiteral(Source, LiteralStart, PGSIZE, Destination, Out, Limit)) < 0)
+	{
+		return 0;
+	}
+	return Out;
+}
+
+/*
+描述：解压一页
+参数：压缩数据，压缩数据字节数，目标页
+返回：无
+*/
+static void DecompressPage(uchar *Source, int Size, uchar *Destination)
+{
+	int In = 0, Out = 0, Length, Distance;
+	uchar Token;
+
+	while (In < Size)
+	{
+		Token = Source[In ++];
+		if (Token & 0x80)
+		{
+			Length = (Token & 0x7f) + COMPRESS_MIN_MATCH;
+			Distance = Source[In] | (Source[In + 1] << 8);
+			In += 2;
+			if (Distance == 0 || Distance > Out || Out + Length > PGSIZE)
+			{
+				panic("[ERROR] Bad compressed page!");
+			}
+			//重叠的匹配要逐字节复制
+			for (; Length > 0; Length --, Out ++)
+			{
+				Destination[Out] = Destination[Out - Distance];
+			}
+		}
+		else
+		{
+			Length = Token + 1;
+			if (Out + Length > PGSIZE || In + Length > Size)
+			{
+				panic("[ERROR] Bad compressed page!");
+			}
+			memmove(Destination + Out, Source + In, Length);
+			In += Length;
+			Out += Length;
+		}
+	}
+	if (Out != PGSIZE)
+	{
+		panic("[ERROR] Bad compressed page!");
+	}
+}
+
+//以下函数调用时持有CompressedSwap.Lock
+static void LinkCompressedPage(struct CompressedPage *Page)
+{
+	Page->Last = 0;
+	Page->Next = CompressedSwap.Head;
+	if (Page->Next)
+	{
+		Page->Next->Last = Page;
+	}
+	else
+	{
+		CompressedSwap.Tail = Page;
+	}
+	CompressedSwap.Head = Page;
+}
+
+static void UnlinkCompressedPage(struct CompressedPage *Page)
+{
+	if (Page->Last)
+	{
+		Page->Last->Next = Page->Next;
+	}
+	else
+	{
+		CompressedSwap.Head = Page->Next;
+	}
+	if (Page->Next)
+	{
+		Page->Next->Last = Page->Last;
+	}
+	else
+	{
+		CompressedSwap.Tail = Page->Last;
+	}
+}
+
+static void FreeCompressedPage(struct CompressedPage *Page)
+{
+	CompressedSwap.PoolSize -= CompressedClassSize[Page->Class];
+	xadd(&VirtualMemoryStat.CompressedPageNum, -1);
+	kmemcachefree(&CompressedSwap.Cache[Page->Class], Page);
+}
+
+/*
+描述：把一个槽的压缩页从区段上摘下来释放，正在写回的页只标记Dead，由写回的进程释放
+参数：区段，槽在区段里的序号
+返回：无
+*/
+static void DetachCompressedPage(struct SwapExtent *Extent, int Index)
+{
+	struct CompressedPage *Page = Extent->Compressed[Index];
+
+	if (Page == 0)
+	{
+		return;
+	}
+	Extent->Compressed[Index] = 0;
+	if (Page->Writeback)
+	{
+		Page->Dead = 1;
+		return;
+	}
+	UnlinkCompressedPage(Page);
+	FreeCompressedPage(Page);
+}
+
+/*
+描述：把一个压缩页解压写回它的交换槽，然后释放。调用时持有Lock和WorkLock，写外存期间放开Lock，
+这期间换入这个槽的进程仍然从压缩页解压
+参数：压缩页，必须在池的链表里
+返回：无，返回时持有Lock
+*/
+static void WritebackCompressedPage(struct CompressedPage *Page)
+{
+	UnlinkCompressedPage(Page);
+	Page->Writeback = 1;
+	DecompressPage(Page->Data, Page->Size, CompressedSwap.Page);
+	release(&CompressedSwap.Lock);
+
+	WriteSwapExtent(Page->Extent, (char *)CompressedSwap.Page, Page->Index * PGSIZE);
+	xadd(&VirtualMemoryStat.CompressedWritebackNum, 1);
+
+	acquire(&CompressedSwap.Lock);
+	if (!Page->Dead)
+	{
+		Page->Extent->Compressed[Page->Index] = 0;
+	}
+	FreeCompressedPage(Page);
+}
+
+/*
+描述：把要写进交换槽的一页压缩放进池里，槽里原来的压缩页作废。池超过COMPRESSED_SWAP_POOL_SIZE时写回最冷的页。
+可能睡眠
+参数：区段，槽在区段里的序号，页
+返回：放进池里1；压缩不了或者分配不到内存0，这时调用者要把这一页写外存
+*/
+int StoreCompressedPage(struct SwapExtent *Extent, int Index, char *Page)
+{
+	struct CompressedPage *Compressed = 0;
+	int Size, Class = 0;
+
+	if (COMPRESSED_SWAP_POOL_SIZE == 0)
+	{
+		return 0;
+	}
+	acquiresleep(&CompressedSwap.WorkLock);
+	if ((Size = CompressPage((uchar *)Page, CompressedSwap.Buffer, COMPRESSED_DATA_MAX)) > 0)
+	{
+		while (CompressedClassSize[Class] < sizeof(struct CompressedPage) + Size)
+		{
+			Class ++;
+		}
+		Compressed = (struct CompressedPage *)kmemcachealloc(&CompressedSwap.Cache[Class]);
+	}
+
+	acquire(&CompressedSwap.Lock);
+	DetachCompressedPage(Extent, Index);
+	if (Compressed)
+	{
+		Compressed->Extent = Extent;
+		Compressed->Index = Index;
+		Compressed->Size = Size;
+		Compressed->Class = Class;
+		Compressed->Writeback = 0;
+		Compressed->Dead = 0;
+		memmove(Compressed->Data, CompressedSwap.Buffer, Size);
+		LinkCompressedPage(Compressed);
+		Extent->Compressed[Index] = Compressed;
+		CompressedSwap.PoolSize += CompressedClassSize[Class];
+		xadd(&VirtualMemoryStat.CompressedPageNum, 1);
+		xadd(&VirtualMemoryStat.CompressedStoreNum, 1);
+		xadd(&VirtualMemoryStat.CompressedByteNum, Size);
+	}
+	else
+	{
+		xadd(&VirtualMemoryStat.CompressedRejectNum, 1);
+	}
+	while (CompressedSwap.PoolSize > COMPRESSED_SWAP_POOL_SIZE && CompressedSwap.Tail)
+	{
+		WritebackCompressedPage(CompressedSwap.Tail);
+	}
+	release(&CompressedSwap.Lock);
+	releasesleep(&CompressedSwap.WorkLock);
+	return Compressed != 0;
+}
+
+/*
+描述：换入时先在池里找这个槽，找到了解压到页里。压缩页留在池里，作为这个槽的内容
+参数：区段，槽在区段里的序号，页
+返回：命中1，没有0（调用者读外存）
+*/
+int LoadCompressedPage(struct SwapExtent *Extent, int Index, char *Page)
+{
+	struct CompressedPage *Compressed;
+
+	acquire(&CompressedSwap.Lock);
+	if ((Compressed = Extent->Compressed[Index]) != 0)
+	{
+		DecompressPage(Compressed->Data, Compressed->Size, (uchar *)Page);
+	}
+	release(&CompressedSwap.Lock);
+	xadd(Compressed ? &VirtualMemoryStat.CompressedHitNum : &VirtualMemoryStat.CompressedMissNum, 1);
+	return Compressed != 0;
+}
+
+/*
+描述：槽被释放时丢掉它的压缩页，不睡眠，可以在持有ptable.lock时调用。
+共享的区段里区段的所有者可能已经又分配了这个槽并放进了新的压缩页，这时槽又有了引用，不丢
+参数：区段，槽在区段里的序号
+返回：无
+*/
+void DropCompressedPage(struct SwapExtent *Extent, int Index)
+{
+	acquire(&CompressedSwap.Lock);
+	if (Extent->SlotRef[Index] == 0)
+	{
+		DetachCompressedPage(Extent, Index);
+	}
+	release(&CompressedSwap.Lock);
+}
+
+/*
+描述：按不到一页读写一个槽之前（只在交换空间满了原地交换时），先把它的压缩页写回外存
+参数：区段，槽在区段里的序号
+返回：无
+*/
+void FlushCompressedPage(struct SwapExtent *Extent, int Index)
+{
+	acquiresleep(&CompressedSwap.WorkLock);
+	acquire(&CompressedSwap.Lock);
+	if (Extent->Compressed[Index])
+	{
+		WritebackCompressedPage(Extent->Compressed[Index]);
+	}
+	release(&CompressedSwap.Lock);
+	releasesleep(&CompressedSwap.WorkLock);
+}
+
+/*
+描述：区段释放之前丢掉它所有的压缩页。拿到WorkLock说明没有页正在往这个区段写回
+参数：区段
+返回：无
+*/
+void ReleaseCompressedPages(struct SwapExtent *Extent)
+{
+	int i;
+
+	acquiresleep(&CompressedSwap.WorkLock);
+	acquire(&CompressedSwap.Lock);
+	for (i = 0; i < SWAP_EXTENT_PAGES; i ++)
+	{
+		DetachCompressedPage(Extent, i);
+	}
+	release(&CompressedSwap.Lock);
+	releasesleep(&CompressedSwap.WorkLock);
+}
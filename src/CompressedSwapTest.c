@@ -0,0 +1,122 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define PAGE_SIZE 4096
+#define SWAPPED_PAGE_NUM 256
+
+/*
+描述：读取压缩交换池的统计（见GetMemoryInfo）
+参数：存放7个统计值的数组
+返回：无
+*/
+void GetCompressedStat(int *Stat)
+{
+    char Info[MEMORY_INFO_SIZE];
+    int i;
+    GetMemoryInfo(Info);
+    for (i = 0; i < 7; i ++)
+    {
+        Stat[i] = MemoryInfo(Info, MI_COMPRESSED + i);
+    }
+}
+
+/*
+描述：按页号填一页：偶数页大部分是0，奇数页是重复的文本
+参数：页，页号
+返回：无
+*/
+void FillPage(char *Page, int Number)
+{
+    static char Text[] = "the quick brown fox jumps over the lazy dog; ";
+    int i;
+    if (Number % 2 == 0)
+    {
+        Page[0] = (char)Number;
+        Page[PAGE_SIZE / 2] = (char)(Number >> 8);
+        return;
+    }
+    for (i = 0; i < PAGE_SIZE; i ++)
+    {
+        Page[i] = Text[i % (sizeof(Text) - 1)];
+    }
+    Page[0] = (char)Number;
+    Page[PAGE_SIZE - 1] = (char)(Number >> 8);
+}
+
+int CheckPage(char *Page, int Number)
+{
+    static char Text[] = "the quick brown fox jumps over the lazy dog; ";
+    int i;
+    for (i = 1; i < PAGE_SIZE - 1; i ++)
+    {
+        char Expected = (Number % 2 == 0) ? 0 : Text[i % (sizeof(Text) - 1)];
+        if (Number % 2 == 0 && i == PAGE_SIZE / 2)
+        {
+            Expected = (char)(Number >> 8);
+        }
+        if (Page[i] != Expected)
+        {
+            return 0;
+        }
+    }
+    if (Number % 2 == 0)
+    {
+        return Page[0] == (char)Number && Page[PAGE_SIZE - 1] == 0;
+    }
+    return Page[0] == (char)Number && Page[PAGE_SIZE - 1] == (char)(Number >> 8);
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Compressed swap test started.\n");
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    int PageNum = MemoryInfo(Info, MI_RESIDENTLIMIT) + SWAPPED_PAGE_NUM;
+    int Before[7], After[7];
+    int i;
+
+    GetCompressedStat(Before);
+    //写满驻留上限再多写256页，最早的256页被换出，它们大部分是0或者是重复的文本，应该都能压缩进池里
+    //先读一遍，这样只会映射4KB页，不会用不参与置换的4MB大页
+    char* Arena = sbrk(PageNum * PAGE_SIZE);
+    int Sum = 0;
+    for (i = 0; i < PageNum; i ++)
+    {
+        Sum += Arena[i * PAGE_SIZE];
+    }
+    for (i = 0; i < PageNum; i ++)
+    {
+        FillPage(&Arena[i * PAGE_SIZE], i + Sum);
+    }
+
+    //被换出的页都应该能正确换回来
+    for (i = 0; i < PageNum; i ++)
+    {
+        if (!CheckPage(&Arena[i * PAGE_SIZE], i))
+        {
+            printf(1, "Compressed swap test failed: page %d has wrong data.\n", i);
+            exit();
+        }
+    }
+    GetCompressedStat(After);
+
+    int StoreNum = After[0] - Before[0];
+    int ByteNum = After[1] - Before[1];
+    int HitNum = After[3] - Before[3];
+    int MissNum = After[4] - Before[4];
+    printf(1, "Pages compressed: %d; rejected: %d; written back: %d\n", StoreNum, After[2] - Before[2], After[5] - Before[5]);
+    if (ByteNum > 0)
+    {
+        printf(1, "Compression ratio: %d.%d\n", StoreNum * PAGE_SIZE / ByteNum, StoreNum * PAGE_SIZE * 10 / ByteNum % 10);
+    }
+    if (HitNum + MissNum > 0)
+    {
+        printf(1, "Swap-in hits: %d; misses: %d; hit rate: %d%%\n", HitNum, MissNum, HitNum * 100 / (HitNum + MissNum));
+    }
+    printf(1, "Compressed swap test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -0,0 +1,71 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PAGE_SIZE 4096
+#define ARENA_PAGE_NUM 64
+#define ROUND_NUM 200
+
+/*
+描述：反复申请一块堆内存，每页写一次再释放，让内核不停地kalloc和kfree
+参数：无
+返回：无
+*/
+void AllocAndFree(void)
+{
+    int Round, i;
+    for (Round = 0; Round < ROUND_NUM; Round ++)
+    {
+        char* Arena = sbrk(ARENA_PAGE_NUM * PAGE_SIZE);
+        for (i = 0; i < ARENA_PAGE_NUM; i ++)
+        {
+            Arena[i * PAGE_SIZE] = (char)Round;
+        }
+        sbrk(-ARENA_PAGE_NUM * PAGE_SIZE);
+    }
+}
+
+/*
+描述：同时运行若干个子进程做AllocAndFree，返回全部结束用的时钟数
+参数：子进程数
+返回：时钟数
+*/
+int TimeConcurrentAlloc(int ProcessNum)
+{
+    int Start = uptime();
+    int i;
+    for (i = 0; i < ProcessNum; i ++)
+    {
+        int Pid = fork();
+        if (Pid < 0)
+        {
+            printf(1, "Kalloc scale test failed: fork failed.\n");
+            exit();
+        }
+        if (Pid == 0)
+        {
+            AllocAndFree();
+            exit();
+        }
+    }
+    for (i = 0; i < ProcessNum; i ++)
+    {
+        wait();
+    }
+    return uptime() - Start;
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Kalloc scale test started.\n");
+    //每个子进程的工作量相同，CPU数够用时时钟数应该基本不随进程数增长
+    int ProcessNum;
+    for (ProcessNum = 1; ProcessNum <= 8; ProcessNum *= 2)
+    {
+        printf(1, "%d processes, %d pages each: %d ticks.\n", ProcessNum, ARENA_PAGE_NUM * ROUND_NUM, TimeConcurrentAlloc(ProcessNum));
+    }
+    printf(1, "Kalloc scale test finished.\n");
+    printf(1, "================================\n");
+    exit();
+}
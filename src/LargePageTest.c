@@ -0,0 +1,108 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define PAGE_SIZE 4096
+#define LARGE_PAGE_SIZE (4096 * 1024)
+#define ARENA_SIZE (3 * LARGE_PAGE_SIZE)
+#define PASS_NUM 64
+
+/*
+描述：读取当前进程在内存中的页数（见GetMemoryInfo），大页按1024页计算
+参数：无
+返回：页数，找不到返回-1
+*/
+int GetResidentPageNum(void)
+{
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    return ProcessMemoryInfo(Info, FindProcessMemoryInfo(Info, getpid()), MIP_MEMORYPAGES);
+}
+
+/*
+描述：每页读一次，重复若干遍，返回用的时钟数
+参数：起始地址，字节数
+返回：时钟数
+*/
+int TimeStrideAccess(char* Arena, int Size)
+{
+    int Start = uptime();
+    int Pass, i, Sum = 0;
+    for (Pass = 0; Pass < PASS_NUM; Pass ++)
+    {
+        for (i = 0; i < Size; i += PAGE_SIZE)
+        {
+            Sum += Arena[i];
+        }
+    }
+    if (Sum == -1)
+    {
+        printf(1, "Impossible.\n");
+    }
+    return uptime() - Start;
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Large page test started.\n");
+    int i;
+
+    //先写：对齐的4MB区域会直接映射大页
+    int Before = GetResidentPageNum();
+    char* Large = sbrk(ARENA_SIZE);
+    for (i = 0; i < ARENA_SIZE; i += PAGE_SIZE)
+    {
+        Large[i] = (char)(i / PAGE_SIZE);
+    }
+    printf(1, "Written %d pages, resident pages grew by %d.\n", ARENA_SIZE / PAGE_SIZE, GetResidentPageNum() - Before);
+
+    //先读：映射了零页之后区域就不能再用大页，只能用4KB页
+    char* Small = sbrk(ARENA_SIZE);
+    int Sum = 0;
+    for (i = 0; i < ARENA_SIZE; i += PAGE_SIZE)
+    {
+        Sum += Small[i];
+    }
+    for (i = 0; i < ARENA_SIZE; i += PAGE_SIZE)
+    {
+        Small[i] = (char)(i / PAGE_SIZE) + Sum;
+    }
+    printf(1, "Stride access ticks: large pages %d, 4KB pages %d.\n", TimeStrideAccess(Large, ARENA_SIZE), TimeStrideAccess(Small, ARENA_SIZE));
+
+    //fork之后子进程写，父进程的内容不能变
+    if (fork() == 0)
+    {
+        for (i = 0; i < ARENA_SIZE; i += PAGE_SIZE)
+        {
+            Large[i] = 0;
+        }
+        exit();
+    }
+    wait();
+    for (i = 0; i < ARENA_SIZE; i += PAGE_SIZE)
+    {
+        if (Large[i] != (char)(i / PAGE_SIZE))
+        {
+            printf(1, "Large page test failed: page %d changed by the child.\n", i / PAGE_SIZE);
+            exit();
+        }
+    }
+
+    //缩小堆之后再增长，新的部分要是0
+    sbrk(-ARENA_SIZE);
+    sbrk(-(LARGE_PAGE_SIZE / 2));
+    Large = sbrk(LARGE_PAGE_SIZE / 2);
+    for (i = 0; i < LARGE_PAGE_SIZE / 2; i += PAGE_SIZE)
+    {
+        if (Large[i] != 0)
+        {
+            printf(1, "Large page test failed: memory is not zero after sbrk.\n");
+            exit();
+        }
+    }
+    printf(1, "Large page test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
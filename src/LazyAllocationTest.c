@@ -0,0 +1,90 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define ARENA_PAGE_NUM 1000
+#define TOUCH_STEP 20
+#define PAGE_SIZE 4096
+#define SEQUENTIAL_PAGE_NUM 256
+
+/*
+描述：读取当前进程在内存中的页数（见GetMemoryInfo）
+参数：无
+返回：页数，找不到返回-1
+*/
+int GetResidentPageNum(void)
+{
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    return ProcessMemoryInfo(Info, FindProcessMemoryInfo(Info, getpid()), MIP_MEMORYPAGES);
+}
+
+/*
+描述：读取全局的缺页次数（见GetMemoryInfo）
+参数：无
+返回：缺页次数
+*/
+int GetPageFaultNum(void)
+{
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    return MemoryInfo(Info, MI_PAGEFAULT);
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Lazy allocation test started.\n");
+
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    int FaultAroundPages = MemoryInfo(Info, MI_FAULTAROUND);
+    int Before = GetResidentPageNum();
+    char* Arena = sbrk(ARENA_PAGE_NUM * PAGE_SIZE);
+    int AfterSbrk = GetResidentPageNum();
+
+    //只写5%的页，每次缺页最多顺带预映射FAULT_AROUND_PAGES - 1页
+    int i, TouchedNum = 0;
+    for (i = 0; i < ARENA_PAGE_NUM; i += TOUCH_STEP)
+    {
+        Arena[i * PAGE_SIZE] = (char)i;
+        TouchedNum ++;
+    }
+    int AfterTouch = GetResidentPageNum();
+
+    printf(1, "Reserved %d pages; resident after sbrk: +%d; after touching %d pages: +%d\n", ARENA_PAGE_NUM, AfterSbrk - Before, TouchedNum, AfterTouch - Before);
+    for (i = 0; i < ARENA_PAGE_NUM; i += TOUCH_STEP)
+    {
+        if (Arena[i * PAGE_SIZE] != (char)i || Arena[i * PAGE_SIZE + 1] != 0)
+        {
+            printf(1, "Lazy allocation test failed: wrong content at page %d.\n", i);
+            exit();
+        }
+    }
+    if (AfterSbrk != Before || AfterTouch - Before < TouchedNum || AfterTouch - Before > TouchedNum * FaultAroundPages)
+    {
+        printf(1, "Lazy allocation test failed.\n");
+        exit();
+    }
+
+    //顺序写一块新内存，缺页次数应该只有页数的1/FAULT_AROUND_PAGES左右
+    Arena = sbrk(SEQUENTIAL_PAGE_NUM * PAGE_SIZE);
+    int FaultsBefore = GetPageFaultNum();
+    for (i = 0; i < SEQUENTIAL_PAGE_NUM; i ++)
+    {
+        Arena[i * PAGE_SIZE] = (char)i;
+    }
+    int Faults = GetPageFaultNum() - FaultsBefore;
+    printf(1, "Sequentially writing %d pages took %d page faults.\n", SEQUENTIAL_PAGE_NUM, Faults);
+    if (Faults >= SEQUENTIAL_PAGE_NUM)
+    {
+        printf(1, "Lazy allocation test failed: no fault-around.\n");
+    }
+    else
+    {
+        printf(1, "Lazy allocation test passed.\n");
+    }
+    printf(1, "================================\n");
+    exit();
+}
@@ -1,52 +1,67 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "meminfo.h"
 
-/*
-描述：char转unit函数
-参数: char数组头指针
-返回：uint数
-*/
-unsigned int CharToInt(char* ResultList)
-{
-    unsigned int Number = 0;
-    Number += (ResultList[0] << 24);
-    Number += (ResultList[1] << 16);
-    Number += (ResultList[2] << 8);
-    Number += (ResultList[3]);
-    return Number;
-}
-
+#define LARGE_BLOCK_ORDER 4
 
 void MemoryInfoObtain(void)
 {
-    char ResultList[1200];
+    char ResultList[MEMORY_INFO_SIZE];
     int i = 0;
-    for(i = 0; i < 1200; i ++)
-    {
-        ResultList[i] = 0;
-    }
     GetMemoryInfo(ResultList);
-    unsigned int ProcessNumber = CharToInt(&ResultList[0]);
-    unsigned int PhysicalMemoryUsed = CharToInt(&ResultList[4]) * 4;
-    unsigned int SharedMemoryUsed = CharToInt(&ResultList[8]) * 4;
+    unsigned int ProcessNumber = MemoryInfo(ResultList, MI_PROCESSNUM);
+    unsigned int PhysicalMemoryUsed = MemoryInfo(ResultList, MI_PHYSICALPAGES) * 4;
+    unsigned int SharedMemoryUsed = MemoryInfo(ResultList, MI_SHAREDPAGES) * 4;
 
     printf(1, "Total Processes: %d; Total Physical Memory Used: %dkb; Total Shared Memory User: %dkb\n", ProcessNumber, PhysicalMemoryUsed, SharedMemoryUsed);
-    for(int i = 1; i <= ProcessNumber; i ++)
+    for(i = 0; i < ProcessNumber; i ++)
     {
-        int Base = i * 16;
-        unsigned int ProcessID = CharToInt(&ResultList[Base]);
-        unsigned int MemoryPageUsed = CharToInt(&ResultList[Base + 4]) * 4;
-        unsigned int SwapPageUsed = CharToInt(&ResultList[Base + 8]) * 4;
-        unsigned int SharedPageUsed = CharToInt(&ResultList[Base + 12]) * 4;
+        unsigned int ProcessID = ProcessMemoryInfo(ResultList, i, MIP_PID);
+        unsigned int MemoryPageUsed = ProcessMemoryInfo(ResultList, i, MIP_MEMORYPAGES) * 4;
+        unsigned int SwapPageUsed = ProcessMemoryInfo(ResultList, i, MIP_SWAPPAGES) * 4;
+        unsigned int SharedPageUsed = ProcessMemoryInfo(ResultList, i, MIP_SHAREDPAGES) * 4;
         printf(1, "Process %d: Physical Memory Used: %dkb; Swap Memory Used: %dkb, Shared Memory Used: %dkb\n", ProcessID, MemoryPageUsed, SwapPageUsed, SharedPageUsed);
     }    
+    unsigned int PageFaultNum = MemoryInfo(ResultList, MI_PAGEFAULT);
+    unsigned int SwapInNum = MemoryInfo(ResultList, MI_SWAPIN);
+    unsigned int SwapOutNum = MemoryInfo(ResultList, MI_SWAPOUT);
+    unsigned int SwapWriteNum = MemoryInfo(ResultList, MI_SWAPWRITE);
+    printf(1, "Page Faults: %d; Swap In: %d; Swap Out: %d; Swap Writes: %d\n", PageFaultNum, SwapInNum, SwapOutNum, SwapWriteNum);
+    //伙伴分配器各阶空闲块个数（见param.h里的MAXORDER），空闲页都在小块里说明碎片多
+    int MaxOrder = MemoryInfo(ResultList, MI_MAXORDER);
+    int FreePageNum = 0;
+    int LargeFreePageNum = 0;
+    printf(1, "Free Blocks:");
+    for (i = 0; i <= MaxOrder; i ++)
+    {
+        unsigned int BlockNum = MemoryInfo(ResultList, MI_FREEBLOCK + i);
+        printf(1, " %d", BlockNum);
+        FreePageNum += BlockNum << i;
+        if (i >= LARGE_BLOCK_ORDER)
+        {
+            LargeFreePageNum += BlockNum << i;
+        }
+    }
+    printf(1, "\nFree Pages: %d; In Blocks Of %d Pages Or More: %d\n", FreePageNum, 1 << LARGE_BLOCK_ORDER, LargeFreePageNum);
+    //压缩交换池的统计（见VirtualMemory.h）
+    unsigned int CompressedStoreNum = MemoryInfo(ResultList, MI_COMPRESSED);
+    unsigned int CompressedByteNum = MemoryInfo(ResultList, MI_COMPRESSED + 1);
+    unsigned int CompressedHitNum = MemoryInfo(ResultList, MI_COMPRESSED + 3);
+    unsigned int CompressedMissNum = MemoryInfo(ResultList, MI_COMPRESSED + 4);
+    printf(1, "Compressed Pages Stored: %d (%d bytes); Hits: %d; Misses: %d\n", CompressedStoreNum, CompressedByteNum, CompressedHitNum, CompressedMissNum);
 }
 
 int main()
 {
     MemoryInfoObtain();
     int* a = (int*)malloc(12000 * sizeof(int));
+    int i;
+    //堆是懒分配的，写一遍才真正占用物理内存
+    for (i = 0; i < 12000; i ++)
+    {
+        a[i] = i;
+    }
     AllocSharedMemory(114514);
     MemoryInfoObtain();
     DeallocSharedMemory(114514);
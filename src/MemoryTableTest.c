@@ -0,0 +1,61 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define CHILD_NUM 8
+
+/*
+描述：读取全局已经使用的物理页数（见GetMemoryInfo）
+参数：无
+返回：页数
+*/
+int GetPhysicalPageNum(void)
+{
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    return MemoryInfo(Info, MI_PHYSICALPAGES);
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Memory table test started.\n");
+    char Info[MEMORY_INFO_SIZE];
+    int i;
+
+    GetMemoryInfo(Info);
+    int TableLength = MemoryInfo(Info, MI_TABLELENGTH);
+    //子进程什么都不做，只是睡眠，看每个子进程一共占多少物理页
+    //原来每个进程一创建就分配TableLength（43）页内存表，现在内存表随驻留页按需分配
+    int Before = GetPhysicalPageNum();
+    for (i = 0; i < CHILD_NUM; i ++)
+    {
+        int Pid = fork();
+        if (Pid < 0)
+        {
+            printf(1, "Memory table test failed: fork failed.\n");
+            exit();
+        }
+        if (Pid == 0)
+        {
+            sleep(200);
+            exit();
+        }
+    }
+    sleep(50);
+    int PerChild = (GetPhysicalPageNum() - Before) / CHILD_NUM;
+    for (i = 0; i < CHILD_NUM; i ++)
+    {
+        wait();
+    }
+    printf(1, "Each sleeping child uses %d physical pages.\n", PerChild);
+    if (PerChild >= TableLength)
+    {
+        printf(1, "Memory table test failed: the memory table is still allocated eagerly.\n");
+        exit();
+    }
+    printf(1, "Memory table test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
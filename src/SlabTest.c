@@ -0,0 +1,65 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define PIPE_NUM 7
+
+/*
+描述：读取全局已经使用的物理页数（见GetMemoryInfo）
+参数：无
+返回：页数
+*/
+int GetPhysicalPageNum(void)
+{
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    return MemoryInfo(Info, MI_PHYSICALPAGES);
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Slab test started.\n");
+    int Pipes[PIPE_NUM][2];
+    int i;
+
+    //每个管道原来占一整页，现在几个管道共用一页
+    int Before = GetPhysicalPageNum();
+    for (i = 0; i < PIPE_NUM; i ++)
+    {
+        if (pipe(Pipes[i]) < 0)
+        {
+            printf(1, "Slab test failed: pipe %d failed.\n", i);
+            exit();
+        }
+    }
+    int Used = GetPhysicalPageNum() - Before;
+    printf(1, "%d pipes used %d physical pages.\n", PIPE_NUM, Used);
+
+    //每个管道各写各读，内容不能串
+    for (i = 0; i < PIPE_NUM; i ++)
+    {
+        char Data = 'a' + i;
+        write(Pipes[i][1], &Data, 1);
+    }
+    for (i = 0; i < PIPE_NUM; i ++)
+    {
+        char Data = 0;
+        if (read(Pipes[i][0], &Data, 1) != 1 || Data != 'a' + i)
+        {
+            printf(1, "Slab test failed: pipe %d read wrong data.\n", i);
+            exit();
+        }
+        close(Pipes[i][0]);
+        close(Pipes[i][1]);
+    }
+    if (Used >= PIPE_NUM)
+    {
+        printf(1, "Slab test failed: pipes did not share pages.\n");
+        exit();
+    }
+    printf(1, "Slab test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
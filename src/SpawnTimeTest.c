@@ -0,0 +1,42 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define SPAWN_NUM 50
+
+int main(int argc, char *argv[])
+{
+    //被exec的子进程什么都不做，直接退出
+    if (argc > 1)
+    {
+        exit();
+    }
+
+    printf(1, "================================\n");
+    printf(1, "Spawn time test started.\n");
+    char *Argv[] = { "SpawnTimeTest", "child", 0 };
+    int i;
+
+    //不换页的进程不再创建交换空间，fork，exec，exit都不做文件系统操作
+    int StartTicks = uptime();
+    for (i = 0; i < SPAWN_NUM; i ++)
+    {
+        int pid = fork();
+        if (pid < 0)
+        {
+            printf(1, "Spawn time test failed: fork failed.\n");
+            exit();
+        }
+        if (pid == 0)
+        {
+            exec(Argv[0], Argv);
+            printf(1, "Spawn time test failed: exec failed.\n");
+            exit();
+        }
+        wait();
+    }
+    printf(1, "%d fork + exec + exit took %d ticks.\n", SPAWN_NUM, uptime() - StartTicks);
+    printf(1, "Spawn time test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -0,0 +1,46 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define PAGE_SIZE 4096
+#define SWAPPED_PAGE_NUM 1280
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Swap extent test started.\n");
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    int PageNum = MemoryInfo(Info, MI_RESIDENTLIMIT) + SWAPPED_PAGE_NUM;
+    int i;
+
+    //写满驻留上限再多写1280页（5MB），被换出的页超过原来6个交换文件的96个槽，
+    //用到的区段（80个）也超过原来固定长度的区段表（64个区段，4MB）
+    //先读一遍，这样只会映射4KB页，不会用不参与置换的4MB大页
+    char* Arena = sbrk(PageNum * PAGE_SIZE);
+    int Sum = 0;
+    for (i = 0; i < PageNum; i ++)
+    {
+        Sum += Arena[i * PAGE_SIZE];
+    }
+    for (i = 0; i < PageNum; i ++)
+    {
+        Arena[i * PAGE_SIZE] = (char)i + Sum;
+        Arena[i * PAGE_SIZE + PAGE_SIZE - 1] = (char)(i >> 8) + Sum;
+    }
+
+    //被换出的页都应该能正确换回来
+    for (i = 0; i < PageNum; i ++)
+    {
+        if (Arena[i * PAGE_SIZE] != (char)i || Arena[i * PAGE_SIZE + PAGE_SIZE - 1] != (char)(i >> 8))
+        {
+            printf(1, "Swap extent test failed: page %d has wrong data.\n", i);
+            exit();
+        }
+    }
+    printf(1, "%d pages beyond the resident limit were swapped out and back.\n", SWAPPED_PAGE_NUM);
+    printf(1, "Swap extent test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -0,0 +1,99 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define PAGE_SIZE 4096
+#define SWAPPED_PAGE_NUM 128
+
+/*
+描述：读取全局的换入换出统计（见GetMemoryInfo）
+参数：结果数组：缺页次数，换入次数，换出次数，写外存次数
+返回：无
+*/
+void GetSwapStatistics(int* Result)
+{
+    char Info[MEMORY_INFO_SIZE];
+    int i;
+    GetMemoryInfo(Info);
+    for (i = 0; i < 4; i ++)
+    {
+        Result[i] = MemoryInfo(Info, MI_PAGEFAULT + i);
+    }
+}
+
+/*
+描述：检查每一页的内容
+参数：内存，页数，每页期望的值加上的偏移
+返回：正确1，错误0
+*/
+int CheckPages(char* Arena, int PageNum, int Delta)
+{
+    int i;
+    for (i = 0; i < PageNum; i ++)
+    {
+        if (Arena[i * PAGE_SIZE] != (char)(i + Delta))
+        {
+            printf(1, "Swap fork test failed: page %d has wrong data.\n", i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Swap fork test started.\n");
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    int PageNum = MemoryInfo(Info, MI_RESIDENTLIMIT) + SWAPPED_PAGE_NUM;
+    int i, Before[4], After[4];
+
+    //写满驻留上限再多写128页，最早写的页被换出
+    //先读一遍，这样只会映射4KB页，不会用不参与置换的4MB大页
+    char* Arena = sbrk(PageNum * PAGE_SIZE);
+    int Sum = 0;
+    for (i = 0; i < PageNum; i ++)
+    {
+        Sum += Arena[i * PAGE_SIZE];
+    }
+    for (i = 0; i < PageNum; i ++)
+    {
+        Arena[i * PAGE_SIZE] = (char)i + Sum;
+    }
+
+    //fork不复制交换空间，不应该写外存
+    GetSwapStatistics(Before);
+    int pid = fork();
+    if (pid == 0)
+    {
+        GetSwapStatistics(After);
+        printf(1, "Swap writes during fork: %d\n", After[3] - Before[3]);
+        //子进程看到父进程的数据，然后改写所有页，被换出的页写到子进程自己的槽里
+        if (!CheckPages(Arena, PageNum, 0))
+        {
+            exit();
+        }
+        for (i = 0; i < PageNum; i ++)
+        {
+            Arena[i * PAGE_SIZE] = (char)(i + 1);
+        }
+        if (!CheckPages(Arena, PageNum, 1))
+        {
+            exit();
+        }
+        printf(1, "Child sees and updates the shared swapped pages.\n");
+        exit();
+    }
+    wait();
+
+    //子进程的改写不能影响父进程
+    if (!CheckPages(Arena, PageNum, 0))
+    {
+        exit();
+    }
+    printf(1, "Swap fork test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
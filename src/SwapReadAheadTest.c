@@ -0,0 +1,65 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define PAGE_SIZE 4096
+#define SWAPPED_PAGE_NUM 64
+
+/*
+描述：读取全局的缺页次数（见GetMemoryInfo）
+参数：无
+返回：缺页次数
+*/
+int GetPageFaultNum(void)
+{
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    return MemoryInfo(Info, MI_PAGEFAULT);
+}
+
+int main()
+{
+    printf(1, "================================\n");
+    printf(1, "Swap read-ahead test started.\n");
+    char Info[MEMORY_INFO_SIZE];
+    GetMemoryInfo(Info);
+    int PageNum = MemoryInfo(Info, MI_RESIDENTLIMIT) + SWAPPED_PAGE_NUM;
+    int i;
+
+    //写满驻留上限再多写一些，最早写的页被换出，交换槽按换出顺序连续分配
+    //先读一遍，这样只会映射4KB页，不会用不参与置换的4MB大页
+    char* Arena = sbrk(PageNum * PAGE_SIZE);
+    int Sum = 0;
+    for (i = 0; i < PageNum; i ++)
+    {
+        Sum += Arena[i * PAGE_SIZE];
+    }
+    for (i = 0; i < PageNum; i ++)
+    {
+        Arena[i * PAGE_SIZE] = (char)i + Sum;
+    }
+    //预读只用余量，放掉最后写的页，让换入的页不用再换出本进程的页
+    sbrk(-2 * SWAPPED_PAGE_NUM * PAGE_SIZE);
+
+    //顺序读被换出的页：预读窗口逐渐加倍，缺页次数应该远少于页数
+    int Before = GetPageFaultNum();
+    for (i = 0; i < SWAPPED_PAGE_NUM; i ++)
+    {
+        if (Arena[i * PAGE_SIZE] != (char)i)
+        {
+            printf(1, "Swap read-ahead test failed: page %d has wrong data.\n", i);
+            exit();
+        }
+    }
+    int Faults = GetPageFaultNum() - Before;
+    printf(1, "Sequential read of %d swapped pages took %d page faults.\n", SWAPPED_PAGE_NUM, Faults);
+    if (Faults >= SWAPPED_PAGE_NUM)
+    {
+        printf(1, "Swap read-ahead test failed: no pages were read ahead.\n");
+        exit();
+    }
+    printf(1, "Swap read-ahead test passed.\n");
+    printf(1, "================================\n");
+    exit();
+}
@@ -13,6 +13,41 @@
 #include "proc.h"
 #include "elf.h"
 
+struct VirtualMemoryStatistics VirtualMemoryStat;
+
+//以下是虚拟地址索引的维护函数，索引是按页号哈希的链表，插入删除都是常数时间
+/*
+描述：把一个内存entry按它的虚拟地址加入索引
+参数：当前进程，entry
+返回：无
+*/
+void AddToMemoryIndex(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry)
+{
+	struct MemoryTableEntry **Bucket = &(CurrentProcess->AddressIndex->MemoryBucket[ADDRESS_INDEX_HASH(TheEntry->VirtualAddress)]);
+	TheEntry->HashNext = *Bucket;
+	*Bucket = TheEntry;
+}
+
+/*
+描述：把一个内存entry从索引中移除
+参数：当前进程，entry
+返回：无
+*/
+void RemoveFromMemoryIndex(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry)
+{
+	struct MemoryTableEntry **Place = &(CurrentProcess->AddressIndex->MemoryBucket[ADDRESS_INDEX_HASH(TheEntry->VirtualAddress)]);
+	while (*Place != TheEntry)
+	{
+		if (*Place == 0)
+		{
+			panic("[ERROR] The entry should be in the memory index!");
+		}
+		Place = &((*Place)->HashNext);
+	}
+	*Place = TheEntry->HashNext;
+	TheEntry->HashNext = 0;
+}
+
 
 //以下是虚拟内存数据结构的动态修改，更新函数，主要用于虚拟内存的具体管理---内存分配，释放，处理缺页中断
 /*
@@ -40,55 +75,159 @@ struct MemoryTableEntry* GetMemoryListTail(struct proc *CurrentProcess)
 }
 
 /*
-描述：将一个entry地址设置为指定地址，并且设置为链表头
+描述：将一个entry地址设置为指定地址，并且设置为链表头，地址变化时同时更新索引
 参数：当前进程，新头entry，新头地址
 返回：无
 */
 void SetMemoryListHead(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry, char* TheVirtualAddress)
 {
+	if (TheEntry->VirtualAddress != TheVirtualAddress)
+	{
+		if (TheEntry->VirtualAddress != SLOT_USABLE)
+		{
+			RemoveFromMemoryIndex(CurrentProcess, TheEntry);
+		}
+		TheEntry->VirtualAddress = TheVirtualAddress;
+		AddToMemoryIndex(CurrentProcess, TheEntry);
+	}
+	TheEntry->Last = 0;
 	TheEntry->Next = CurrentProcess->MemoryListHead;
 	CurrentProcess->MemoryListHead->Last = TheEntry;
 	CurrentProcess->MemoryListHead = TheEntry;
-	TheEntry->VirtualAddress = TheVirtualAddress;
 }
 
 /*
-描述：将一个entry地址设置为可用，并且移除出链表
+描述：将一个entry地址设置为可用，并且移除出链表，同时释放它的交换缓存槽
 参数：当前进程，entry
 返回：无
 */
 void RemoveFromMemoryList(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry)
 {
+	RemoveFromMemoryIndex(CurrentProcess, TheEntry);
 	TheEntry->VirtualAddress = SLOT_USABLE;
-    if (CurrentProcess->MemoryListHead == TheEntry)
-    {
-        if (TheEntry->Next != 0)
-		{
-        	TheEntry->Next->Last = 0;
-		}
-        CurrentProcess->MemoryListHead = TheEntry->Next;
-    }
-    else
-    {
-        struct MemoryTableEntry *CurrentPlace = CurrentProcess->MemoryListHead;
-        while (CurrentPlace->Next != TheEntry)
-		{
-            CurrentPlace = CurrentPlace->Next;
-		}
-		if(TheEntry->Next != 0)
-		{
-			TheEntry->Next->Last = CurrentPlace;
-			CurrentPlace->Next = TheEntry->Next;
-		}
-		else
-		{
-			CurrentPlace->Next = 0;
-		}
+	if (TheEntry->SwapSlot != SWAP_SLOT_NONE)
+	{
+		RemoveFromSwapTable(CurrentProcess, TheEntry->SwapSlot);
+		TheEntry->SwapSlot = SWAP_SLOT_NONE;
+	}
 
-    }
+	//用Last指针直接找到前驱，不用从链表头遍历
+	if (TheEntry->Last != 0)
+	{
+		TheEntry->Last->Next = TheEntry->Next;
+	}
+	else
+	{
+		CurrentProcess->MemoryListHead = TheEntry->Next;
+	}
+	if (TheEntry->Next != 0)
+	{
+		TheEntry->Next->Last = TheEntry->Last;
+	}
+	else
+	{
+		CurrentProcess->MemoryListTail = TheEntry->Last;
+	}
     TheEntry->Next = 0;
     TheEntry->Last = 0;
     CurrentProcess->MemoryEntryNum --;
+    FreeMemoryEntry(CurrentProcess, TheEntry);
+}
+
+/*
+描述：把一个空闲entry加入空闲链表头
+参数：当前进程，entry
+返回：无
+*/
+void AddToMemoryFreeList(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry)
+{
+	TheEntry->Last = 0;
+	TheEntry->Next = CurrentProcess->MemoryFreeListHead;
+	if (TheEntry->Next != 0)
+	{
+		TheEntry->Next->Last = TheEntry;
+	}
+	CurrentProcess->MemoryFreeListHead = TheEntry;
+}
+
+/*
+描述：把一个entry从空闲链表里摘下来
+参数：当前进程，entry
+返回：无
+*/
+void RemoveFromMemoryFreeList(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry)
+{
+	if (TheEntry->Last != 0)
+	{
+		TheEntry->Last->Next = TheEntry->Next;
+	}
+	else
+	{
+		CurrentProcess->MemoryFreeListHead = TheEntry->Next;
+	}
+	if (TheEntry->Next != 0)
+	{
+		TheEntry->Next->Last = TheEntry->Last;
+	}
+	TheEntry->Next = 0;
+	TheEntry->Last = 0;
+}
+
+/*
+描述：从空闲链表取一个entry，空闲链表空了就给内存表增加一页
+参数：当前进程
+返回：entry（不在内存链表和索引里），失败返回0
+*/
+struct MemoryTableEntry* GetFreeMemoryEntry(struct proc *CurrentProcess)
+{
+	struct MemoryTableEntry* TheEntry;
+	if (CurrentProcess->MemoryFreeListHead == 0 && GrowMemoryTable(CurrentProcess) == 0)
+	{
+		return 0;
+	}
+	TheEntry = CurrentProcess->MemoryFreeListHead;
+	RemoveFromMemoryFreeList(CurrentProcess, TheEntry);
+	((struct MemoryTablePage *)PGROUNDDOWN((uint)TheEntry))->UsedNum ++;
+	return TheEntry;
+}
+
+/*
+描述：释放一个已经移出链表和索引的entry，放回空闲链表；它所在的内存表页全部空闲时把这一页还给kalloc
+参数：当前进程，entry
+返回：无
+*/
+void FreeMemoryEntry(struct proc *CurrentProcess, struct MemoryTableEntry* TheEntry)
+{
+	int i;
+	struct MemoryTablePage *ThePage = (struct MemoryTablePage *)PGROUNDDOWN((uint)TheEntry);
+	TheEntry->VirtualAddress = SLOT_USABLE;
+	TheEntry->SwapSlot = SWAP_SLOT_NONE;
+	AddToMemoryFreeList(CurrentProcess, TheEntry);
+	if (--ThePage->UsedNum > 0)
+	{
+		return;
+	}
+	for (i = 0; i < MEMORY_TABLE_ENTRY_NUM; i++)
+	{
+		RemoveFromMemoryFreeList(CurrentProcess, &(ThePage->EntryList[i]));
+	}
+	if (ThePage->Last != 0)
+	{
+		ThePage->Last->Next = ThePage->Next;
+	}
+	else
+	{
+		CurrentProcess->MemoryTableListHead = ThePage->Next;
+	}
+	if (ThePage->Next != 0)
+	{
+		ThePage->Next->Last = ThePage->Last;
+	}
+	else
+	{
+		CurrentProcess->MemoryTableListTail = ThePage->Last;
+	}
+	kfree((char *)ThePage);
 }
 
 
@@ -99,112 +238,217 @@ void RemoveFromMemoryList(struct proc *CurrentProcess, struct MemoryTableEntry*
 */
 struct MemoryTableEntry* GetAddressInMemoryTable(struct proc *CurrentProcess, char* TheVirtualAddress)
 {
-	struct MemoryTablePage *CurrentPage;
 	struct MemoryTableEntry* ThePlace;
-	int EntryNum = 0, PageNum = 0;
 
-	//在原来swaptable找
-	CurrentPage = CurrentProcess->MemoryTableListHead;
-	while (CurrentPage != 0)
+	//在索引对应的桶里找
+	ThePlace = CurrentProcess->AddressIndex->MemoryBucket[ADDRESS_INDEX_HASH(TheVirtualAddress)];
+	while (ThePlace != 0)
 	{
-		for (EntryNum = 0; EntryNum < MEMORY_TABLE_ENTRY_NUM; EntryNum ++)
+		if (ThePlace->VirtualAddress == TheVirtualAddress)
 		{
-			if (CurrentPage->EntryList[EntryNum].VirtualAddress == TheVirtualAddress)
+			return ThePlace;
+		}
+		ThePlace = ThePlace->HashNext;
+	}
+	panic("[ERROR] Should find a record in memory table!");
+}
+
+/*
+描述：根据交换表entry算出它在交换表里的位置和交换槽号，外存偏移是槽号 * PGSIZE
+参数：交换表entry
+返回：位置和槽号
+*/
+struct SwapTablePlace GetSwapTablePlace(struct SwapTableEntry* TheEntry)
+{
+	struct SwapTablePlace ThePlace;
+	struct SwapTablePage *ThePage = (struct SwapTablePage *)PGROUNDDOWN((uint)TheEntry);
+	ThePlace.Place = TheEntry;
+	ThePlace.Slot = ThePage->PageNum * SWAP_TABLE_ENTRY_NUM + (TheEntry - ThePage->EntryList);
+	return ThePlace;
+}
+
+
+/*
+描述：在一页交换表的位图里找空位，和别的进程共享的区段里只有区段的所有者能分配没人用的槽（见CanAllocSwapSlot）
+参数：当前进程，交换表的一页
+返回：空位的entry下标，没有空位返回-1
+*/
+int GetEmptyInSwapPage(struct proc *CurrentProcess, struct SwapTablePage *CurrentPage)
+{
+	int WordNum, BitNum;
+	for (WordNum = 0; WordNum < SWAP_TABLE_BITMAP_LENGTH; WordNum ++)
+	{
+		if (CurrentPage->UsedBitmap[WordNum] == 0xffffffff)
+		{
+			continue;
+		}
+		for (BitNum = 0; BitNum < 32; BitNum ++)
+		{
+			if (!(CurrentPage->UsedBitmap[WordNum] & (1 << BitNum)) &&
+				CanAllocSwapSlot(CurrentProcess, CurrentPage->PageNum * SWAP_TABLE_ENTRY_NUM + WordNum * 32 + BitNum))
 			{
-				ThePlace = &(CurrentPage->EntryList[EntryNum]);
-				return ThePlace;
+				return WordNum * 32 + BitNum;
 			}
 		}
-		CurrentPage = CurrentPage->Next;
-		PageNum ++;
 	}
-	panic("[ERROR] Should find a record in memory table!");
+	return -1;
+}
+
+/*
+描述：找Num个连续的、能分配的空槽，给一批换出的页用（见ReclaimMemory），交换表不够长时增加交换表页
+参数：当前进程，槽数
+返回：第一个槽的槽号，找不到返回SWAP_SLOT_NONE
+*/
+uint GetEmptySwapRun(struct proc *CurrentProcess, int Num)
+{
+	struct SwapTablePage *CurrentPage = CurrentProcess->SwapTableListHead;
+	uint Slot, Start = 0;
+	int Length = 0, EntryNum;
+	//交换表后面的槽都是空的，所以一定能找到，交换空间够不够由调用者用GrowSwapSpace检查
+	for (Slot = 0; Length < Num; Slot ++)
+	{
+		EntryNum = Slot % SWAP_TABLE_ENTRY_NUM;
+		if (EntryNum == 0 && Slot != 0 && CurrentPage != 0)
+		{
+			CurrentPage = CurrentPage->Next;
+		}
+		//交换表后面的槽都是空的
+		if ((CurrentPage == 0 || !(CurrentPage->UsedBitmap[EntryNum / 32] & (1 << (EntryNum % 32)))) && CanAllocSwapSlot(CurrentProcess, Slot))
+		{
+			if (Length ++ == 0)
+			{
+				Start = Slot;
+			}
+		}
+		else
+		{
+			Length = 0;
+		}
+	}
+	while (CurrentProcess->SwapTableListTail == 0 || (CurrentProcess->SwapTableListTail->PageNum + 1) * SWAP_TABLE_ENTRY_NUM < Start + Num)
+	{
+		if (GrowSwapTable(CurrentProcess) != 0)
+		{
+			return SWAP_SLOT_NONE;
+		}
+	}
+	return Start;
 }
 
+/*
+描述：如果指定的槽是能分配的空槽，返回它在交换表里的位置
+参数：当前进程，槽号
+返回：位置和槽号，不能用（或者交换表还没有这一页）时位置是0
+*/
+struct SwapTablePlace GetEmptySlotInSwapTable(struct proc *CurrentProcess, uint Slot)
+{
+	struct SwapTablePage *CurrentPage;
+	struct SwapTablePlace ThePlace;
+	int EntryNum = Slot % SWAP_TABLE_ENTRY_NUM;
+	ThePlace.Place = 0;
+	ThePlace.Slot = Slot;
+	for (CurrentPage = CurrentProcess->SwapTableListHead; CurrentPage != 0; CurrentPage = CurrentPage->Next)
+	{
+		if (CurrentPage->PageNum == Slot / SWAP_TABLE_ENTRY_NUM)
+		{
+			if (!(CurrentPage->UsedBitmap[EntryNum / 32] & (1 << (EntryNum % 32))) && CanAllocSwapSlot(CurrentProcess, Slot))
+			{
+				ThePlace.Place = &(CurrentPage->EntryList[EntryNum]);
+			}
+			break;
+		}
+	}
+	return ThePlace;
+}
 
 /*
-描述：在交换表里找空位，没有就新开一个空的位置
+描述：在交换表里找空位，没有就新增交换表页继续找，新页里的槽也要能分配（见GetEmptyInSwapPage）
 参数：当前进程
-返回：空位(包括位置，偏置)
+返回：空位(包括位置，偏置)，槽号用完了或者分配不到交换表页时位置是0
 */
 struct SwapTablePlace GetEmptyInSwapTable(struct proc *CurrentProcess)
 {
 	struct SwapTablePage *CurrentPage;
 	struct SwapTablePlace ThePlace;
-	int EntryNum = 0, PageNum = 0;
+	int EntryNum;
 
-	//在原来swaptable找
+	//在原来swaptable的位图里找
 	CurrentPage = CurrentProcess->SwapTableListHead;
 	while (CurrentPage != 0)
 	{
-		for (EntryNum = 0; EntryNum < SWAP_TABLE_ENTRY_NUM; EntryNum ++)
+		if ((EntryNum = GetEmptyInSwapPage(CurrentProcess, CurrentPage)) >= 0)
 		{
-			if (CurrentPage->EntryList[EntryNum].VirtualAddress == SLOT_USABLE)
-			{
-				ThePlace.Place = &(CurrentPage->EntryList[EntryNum]);
-				ThePlace.Offset = PageNum * SWAP_TABLE_PAGE_OFFSET + EntryNum * PGSIZE;
-				return ThePlace;
-			}
+			return GetSwapTablePlace(&(CurrentPage->EntryList[EntryNum]));
 		}
 		CurrentPage = CurrentPage->Next;
-		PageNum ++;
 	}
 
-	//找不到：新增一页继续
-	GrowSwapTable(CurrentProcess);
-	CurrentPage = CurrentProcess->SwapTableListTail;
-	for (EntryNum = 0; EntryNum < SWAP_TABLE_ENTRY_NUM; EntryNum ++)
+	//找不到：新增一页继续，槽号没有上限，新的槽有没有交换空间由调用者用GrowSwapSpace检查
+	while (GrowSwapTable(CurrentProcess) == 0)
 	{
-		if (CurrentPage->EntryList[EntryNum].VirtualAddress == SLOT_USABLE)
+		CurrentPage = CurrentProcess->SwapTableListTail;
+		if ((EntryNum = GetEmptyInSwapPage(CurrentProcess, CurrentPage)) >= 0)
 		{
-			ThePlace.Place = &(CurrentPage->EntryList[EntryNum]);
-			ThePlace.Offset = PageNum * SWAP_TABLE_PAGE_OFFSET + EntryNum * PGSIZE;
-			return ThePlace;
+			return GetSwapTablePlace(&(CurrentPage->EntryList[EntryNum]));
 		}
 	}
-	panic("[ERROR] Should find an empty place in the swap table!");
+	ThePlace.Place = 0;
+	ThePlace.Slot = SWAP_SLOT_NONE;
+	return ThePlace;
 }
 
 /*
-描述：在交换表里找对应位置
-参数：当前进程，位置
-返回：空位(包括位置，偏置)
+描述：根据交换槽号（页表项里存的）找到交换表entry
+参数：当前进程，槽号
+返回：对应的entry
 */
-struct SwapTablePlace GetAddressInSwapTable(struct proc *CurrentProcess, char* TheVirtualAddress)
+struct SwapTableEntry* GetSlotInSwapTable(struct proc *CurrentProcess, uint Slot)
 {
-	struct SwapTablePage *CurrentPage;
-	struct SwapTablePlace ThePlace;
-	int EntryNum = 0, PageNum = 0;
-
-	//在原来swaptable找
-	CurrentPage = CurrentProcess->SwapTableListHead;
+	struct SwapTablePage *CurrentPage = CurrentProcess->SwapTableListHead;
 	while (CurrentPage != 0)
 	{
-		for (EntryNum = 0; EntryNum < SWAP_TABLE_ENTRY_NUM; EntryNum ++)
+		if (CurrentPage->PageNum == Slot / SWAP_TABLE_ENTRY_NUM)
 		{
-			if (CurrentPage->EntryList[EntryNum].VirtualAddress == TheVirtualAddress)
-			{
-				ThePlace.Place = &(CurrentPage->EntryList[EntryNum]);
-				ThePlace.Offset = PageNum * SWAP_TABLE_PAGE_OFFSET + EntryNum * PGSIZE;
-				return ThePlace;
-			}
+			return &(CurrentPage->EntryList[Slot % SWAP_TABLE_ENTRY_NUM]);
 		}
 		CurrentPage = CurrentPage->Next;
-		PageNum ++;
 	}
-	panic("[ERROR] Should find the place in the swap table!");
+	panic("[ERROR] Should find the slot in the swap table!");
 }
 
 /*
-描述：将一个虚拟地址对应的交换表entry地址设置为可用
-参数：当前进程，地址
+描述：把交换表entry设置为存放指定虚拟地址，并且在位图里标记为使用，新用的槽要增加槽的引用计数
+参数：当前进程，entry，地址
 返回：无
 */
-void RemoveFromSwapTable(struct proc *CurrentProcess, char* TheVirtualAddress)
+void SetSwapTableEntry(struct proc *CurrentProcess, struct SwapTableEntry* TheEntry, char* TheVirtualAddress)
 {
-	struct SwapTablePlace ThePlace = GetAddressInSwapTable(CurrentProcess, TheVirtualAddress);
-	struct SwapTableEntry* TheEntry = ThePlace.Place;
+	struct SwapTablePage *ThePage = (struct SwapTablePage *)PGROUNDDOWN((uint)TheEntry);
+	int EntryNum = TheEntry - ThePage->EntryList;
+	TheEntry->VirtualAddress = TheVirtualAddress;
+	if (!(ThePage->UsedBitmap[EntryNum / 32] & (1 << (EntryNum % 32))))
+	{
+		ThePage->UsedBitmap[EntryNum / 32] |= (1 << (EntryNum % 32));
+		HoldSwapSlot(CurrentProcess, ThePage->PageNum * SWAP_TABLE_ENTRY_NUM + EntryNum);
+	}
+}
+
+/*
+描述：将一个交换槽对应的交换表entry设置为可用，并且减少槽的引用计数
+参数：当前进程，槽号
+返回：无
+*/
+void RemoveFromSwapTable(struct proc *CurrentProcess, uint Slot)
+{
+	struct SwapTableEntry* TheEntry = GetSlotInSwapTable(CurrentProcess, Slot);
+	struct SwapTablePage *ThePage = (struct SwapTablePage *)PGROUNDDOWN((uint)TheEntry);
+	int EntryNum = TheEntry - ThePage->EntryList;
 	TheEntry->VirtualAddress = SLOT_USABLE;
+	if (ThePage->UsedBitmap[EntryNum / 32] & (1 << (EntryNum % 32)))
+	{
+		ThePage->UsedBitmap[EntryNum / 32] &= ~(1 << (EntryNum % 32));
+		ReleaseSwapSlot(CurrentProcess, Slot);
+	}
 }
 
 
@@ -221,8 +465,11 @@ void ClearMemoryPage(struct MemoryTablePage *ThePage, uint WhetherClearLink)
     {
         ThePage->EntryList[i].Last = 0;
         ThePage->EntryList[i].Next = 0;
+        ThePage->EntryList[i].HashNext = 0;
         ThePage->EntryList[i].VirtualAddress = SLOT_USABLE;
+        ThePage->EntryList[i].SwapSlot = SWAP_SLOT_NONE;
     }
+    ThePage->UsedNum = 0;
     if (WhetherClearLink)
     {
         ThePage->Next = 0;
@@ -247,51 +494,128 @@ struct MemoryTablePage *AllocMemoryPage(void)
 }
 
 /*
-描述：清理一个进程的内存表
-参数：进程
+描述：把内存表页和虚拟地址索引都还给kalloc
+参数：第一页内存表，虚拟地址索引
 返回：无
 */
-void ClearMemoryTable(struct proc *CurrentProcess)
+static void FreeMemoryTablePages(struct MemoryTablePage *CurrentPage, struct AddressIndex *Index)
 {
-    struct MemoryTablePage *CurrentPage = CurrentProcess->MemoryTableListHead;
+    struct MemoryTablePage *NextPage;
     while (CurrentPage != 0)
     {
-        ClearMemoryPage(CurrentPage, 0);
-        CurrentPage = CurrentPage->Next;
+        NextPage = CurrentPage->Next;
+        kfree((char *)CurrentPage);
+        CurrentPage = NextPage;
+    }
+    if (Index != 0)
+    {
+        kfree((char *)Index);
     }
+}
+
+/*
+描述：清理一个进程的内存表，内存表页和虚拟地址索引都还给kalloc
+参数：进程
+返回：无
+*/
+void ClearMemoryTable(struct proc *CurrentProcess)
+{
+    FreeMemoryTablePages(CurrentProcess->MemoryTableListHead, CurrentProcess->AddressIndex);
+    CurrentProcess->MemoryTableListHead = 0;
+    CurrentProcess->MemoryTableListTail = 0;
+    CurrentProcess->MemoryFreeListHead = 0;
+    CurrentProcess->AddressIndex = 0;
     CurrentProcess->MemoryEntryNum = 0;
     CurrentProcess->MemoryListHead = 0;
     CurrentProcess->MemoryListTail = 0;
 }
 
 /*
-描述：初始化一个进程的内存表
-参数：进程
+描述：exec建新映像之前调用：把进程的内存表和栈大小存起来，进程换成一个空的内存表，栈大小为0，
+新映像的页都记录在新的内存表里，旧映像的内存表在提交之前保持不变
+参数：进程，保存的位置
+返回：无
+*/
+void SaveMemoryTable(struct proc *CurrentProcess, struct SavedMemoryTable *Saved)
+{
+    Saved->MemoryTableListHead = CurrentProcess->MemoryTableListHead;
+    Saved->MemoryTableListTail = CurrentProcess->MemoryTableListTail;
+    Saved->MemoryListHead = CurrentProcess->MemoryListHead;
+    Saved->MemoryListTail = CurrentProcess->MemoryListTail;
+    Saved->MemoryFreeListHead = CurrentProcess->MemoryFreeListHead;
+    Saved->AddressIndex = CurrentProcess->AddressIndex;
+    Saved->MemoryEntryNum = CurrentProcess->MemoryEntryNum;
+    Saved->StackSize = CurrentProcess->stackSize;
+    CurrentProcess->MemoryTableListHead = 0;
+    CurrentProcess->MemoryTableListTail = 0;
+    CurrentProcess->MemoryListHead = 0;
+    CurrentProcess->MemoryListTail = 0;
+    CurrentProcess->MemoryFreeListHead = 0;
+    CurrentProcess->AddressIndex = 0;
+    CurrentProcess->MemoryEntryNum = 0;
+    CurrentProcess->stackSize = 0;
+}
+
+/*
+描述：exec失败时调用：释放新映像的内存表，放回保存的旧映像的内存表和栈大小
+参数：进程，SaveMemoryTable保存的内存表
 返回：无
 */
-void AllocMemoryTable(struct proc *CurrentProcess)
+void RestoreMemoryTable(struct proc *CurrentProcess, struct SavedMemoryTable *Saved)
+{
+    ClearMemoryTable(CurrentProcess);
+    CurrentProcess->MemoryTableListHead = Saved->MemoryTableListHead;
+    CurrentProcess->MemoryTableListTail = Saved->MemoryTableListTail;
+    CurrentProcess->MemoryListHead = Saved->MemoryListHead;
+    CurrentProcess->MemoryListTail = Saved->MemoryListTail;
+    CurrentProcess->MemoryFreeListHead = Saved->MemoryFreeListHead;
+    CurrentProcess->AddressIndex = Saved->AddressIndex;
+    CurrentProcess->MemoryEntryNum = Saved->MemoryEntryNum;
+    CurrentProcess->stackSize = Saved->StackSize;
+}
+
+/*
+描述：exec提交新映像之后调用：释放保存的旧映像的内存表
+参数：SaveMemoryTable保存的内存表
+返回：无
+*/
+void FreeSavedMemoryTable(struct SavedMemoryTable *Saved)
+{
+    FreeMemoryTablePages(Saved->MemoryTableListHead, Saved->AddressIndex);
+}
+
+/*
+描述：内存表增加一页，接在内存表页链表的尾部，这一页的entry都加入空闲链表，第一页时同时分配虚拟地址索引
+参数：进程
+返回：新的一页，失败返回0
+*/
+struct MemoryTablePage *GrowMemoryTable(struct proc *CurrentProcess)
 {
     int i;
-    struct MemoryTablePage *CurrentPage, *PreviousPage;
-    for (i = 0; i < MEMORY_TABLE_LENGTH; i++)
+    struct MemoryTablePage *NewPage;
+    if (CurrentProcess->AddressIndex == 0 && (CurrentProcess->AddressIndex = (struct AddressIndex *)kalloczeroed()) == 0)
     {
-        if ((CurrentPage = AllocMemoryPage()) == 0)
-        {
-            panic("Alloc Memory Table Failure!\n");
-        }
-        if(i == 0)
-        {
-            CurrentProcess->MemoryTableListHead = CurrentPage;
-            PreviousPage = CurrentPage;
-        }
-        else
-        {
-            PreviousPage->Next = CurrentPage;
-            CurrentPage->Last = PreviousPage;
-            PreviousPage = CurrentPage;
-        }
+        return 0;
     }
-    CurrentProcess->MemoryTableListTail = CurrentPage;
+    if ((NewPage = AllocMemoryPage()) == 0)
+    {
+        return 0;
+    }
+    NewPage->Last = CurrentProcess->MemoryTableListTail;
+    if (CurrentProcess->MemoryTableListTail != 0)
+    {
+        CurrentProcess->MemoryTableListTail->Next = NewPage;
+    }
+    else
+    {
+        CurrentProcess->MemoryTableListHead = NewPage;
+    }
+    CurrentProcess->MemoryTableListTail = NewPage;
+    for (i = MEMORY_TABLE_ENTRY_NUM - 1; i >= 0; i--)
+    {
+        AddToMemoryFreeList(CurrentProcess, &(NewPage->EntryList[i]));
+    }
+    return NewPage;
 }
 
 /*
@@ -306,6 +630,10 @@ void ClearSwapPage(struct SwapTablePage *CurrentPage, uint WhetherClearLink)
     {
         CurrentPage->EntryList[i].VirtualAddress = SLOT_USABLE;
     }
+    for (i = 0; i < SWAP_TABLE_BITMAP_LENGTH; i++)
+    {
+        CurrentPage->UsedBitmap[i] = 0;
+    }
     if (WhetherClearLink)
     {
         CurrentPage->Next = 0;
@@ -330,19 +658,31 @@ struct SwapTablePage* AllocSwapPage(void)
 }
 
 /*
-描述：清理一个进程的交换表
+描述：清理一个进程的交换表，放掉正在用的槽的引用，交换表页还给kalloc，需要时再由GrowSwapTable分配
 参数：进程
 返回：无
 */
 void ClearSwapTable(struct proc *CurrentProcess)
 {
-  	struct SwapTablePage *CurrentPage;
+  	struct SwapTablePage *CurrentPage, *NextPage;
+  	int EntryNum;
   	CurrentPage = CurrentProcess->SwapTableListHead;
 	while (CurrentPage != 0)
   	{
-    	ClearSwapPage(CurrentPage, 0);
-    	CurrentPage = CurrentPage->Next;
+    	NextPage = CurrentPage->Next;
+    	for (EntryNum = 0; EntryNum < SWAP_TABLE_ENTRY_NUM; EntryNum ++)
+    	{
+    		if (CurrentPage->UsedBitmap[EntryNum / 32] & (1 << (EntryNum % 32)))
+    		{
+    			ReleaseSwapSlot(CurrentProcess, CurrentPage->PageNum * SWAP_TABLE_ENTRY_NUM + EntryNum);
+    		}
+    	}
+    	kfree((char *)CurrentPage);
+    	CurrentPage = NextPage;
   	}
+  	CurrentProcess->SwapTableListHead = 0;
+  	CurrentProcess->SwapTableListTail = 0;
+  	CurrentProcess->SwapPageNum = 0;
 }
 
 /*
@@ -362,6 +702,7 @@ int GrowSwapTable(struct proc *CurrentProcess)
     	{
         	return -1;
     	}
+    	(*head)->PageNum = 0;
     	*tail = *head;
   	}
   	else
@@ -373,6 +714,7 @@ int GrowSwapTable(struct proc *CurrentProcess)
     	}
     	temp->Next = *tail;
     	(*tail)->Last = temp;
+    	(*tail)->PageNum = temp->PageNum + 1;
   	}
 
   	return 0;
@@ -385,64 +727,106 @@ int GrowSwapTable(struct proc *CurrentProcess)
 */
 int CopyVirtualMemoryData(struct proc *Destination, struct proc *Source)
 {
-	//复制交换表
+	//复制内存表，目的进程的entry从空闲链表里取，内存表页按需分配
   	ClearMemoryTable(Destination);
   	Destination->MemoryEntryNum = Source->MemoryEntryNum;
   	Destination->MemoryListHead = 0;
   	Destination->MemoryListTail = 0;
 
-  	struct MemoryTablePage *CurrentDestinationPage = Destination->MemoryTableListHead;
-  	int DestinationEntryNum = 0;
+  	struct MemoryTableEntry *CurrentDestinationEntry;
   	struct MemoryTableEntry *CurrentSourceEntry = Source->MemoryListHead;
   	struct MemoryTableEntry *PreviousDestinationEntry = 0;
 
-  	if (CurrentSourceEntry != 0)
-  	{
-    	Destination->MemoryListHead = &(CurrentDestinationPage->EntryList[DestinationEntryNum]);
-  	}
   	while (CurrentSourceEntry != 0)
   	{
-    	if (PreviousDestinationEntry != 0)
+    	if ((CurrentDestinationEntry = GetFreeMemoryEntry(Destination)) == 0)
     	{
-      		PreviousDestinationEntry->Next = &(CurrentDestinationPage->EntryList[DestinationEntryNum]);
+    		Destination->MemoryEntryNum = 0;
+    		return -1;
     	}
-    	CurrentDestinationPage->EntryList[DestinationEntryNum].Last = PreviousDestinationEntry;
-    	PreviousDestinationEntry = &(CurrentDestinationPage->EntryList[DestinationEntryNum]);
-    	CurrentDestinationPage->EntryList[DestinationEntryNum].VirtualAddress = CurrentSourceEntry->VirtualAddress;
-
-    	CurrentSourceEntry = CurrentSourceEntry->Next;
-    	DestinationEntryNum++;
-
-    	if (DestinationEntryNum == MEMORY_TABLE_ENTRY_NUM)
+    	if (PreviousDestinationEntry == 0)
     	{
-      		CurrentDestinationPage = CurrentDestinationPage->Next;
-      		DestinationEntryNum = 0;
+    		Destination->MemoryListHead = CurrentDestinationEntry;
     	}
+    	else
+    	{
+      		PreviousDestinationEntry->Next = CurrentDestinationEntry;
+    	}
+    	CurrentDestinationEntry->Last = PreviousDestinationEntry;
+    	PreviousDestinationEntry = CurrentDestinationEntry;
+    	CurrentDestinationEntry->VirtualAddress = CurrentSourceEntry->VirtualAddress;
+    	CurrentDestinationEntry->SwapSlot = CurrentSourceEntry->SwapSlot;
+    	AddToMemoryIndex(Destination, CurrentDestinationEntry);
+
+    	CurrentSourceEntry = CurrentSourceEntry->Next;
   	}
   	Destination->MemoryListTail = PreviousDestinationEntry;
 
 	//复制交换表
   	int i;
   	struct SwapTablePage *SourceSwapPage, *DestinationSwapPage;
-  	while (Source->SwapPageNum > Destination->SwapPageNum)
-  	{
-    	if (GrowSwapTable(Destination) == 0)
-    	{
-      	return -1;
-    	}
-    	Destination->SwapPageNum ++;
-  	}
-
+  	ClearSwapTable(Destination);
+  	Destination->SwapPageNum = Source->SwapPageNum;
   	SourceSwapPage = Source->SwapTableListHead;
   	DestinationSwapPage = Destination->SwapTableListHead;
   	while (SourceSwapPage != 0)
   	{
+  		if (DestinationSwapPage == 0)
+  		{
+  			if (GrowSwapTable(Destination) != 0)
+  			{
+  				return -1;
+  			}
+  			DestinationSwapPage = Destination->SwapTableListTail;
+  		}
     	for (i = 0; i < SWAP_TABLE_ENTRY_NUM; i++)
     	{
-      	DestinationSwapPage->EntryList[i] = SourceSwapPage->EntryList[i];
+      		if (SourceSwapPage->EntryList[i].VirtualAddress != SLOT_USABLE)
+      		{
+      			SetSwapTableEntry(Destination, &(DestinationSwapPage->EntryList[i]), SourceSwapPage->EntryList[i].VirtualAddress);
+      		}
     	}
     	DestinationSwapPage = DestinationSwapPage->Next;
     	SourceSwapPage = SourceSwapPage->Next;
   	}
   	return 0;
-}
\ No newline at end of file
+}
+/*
+描述：交换空间用完时，从内存链表尾（最久没被用的）开始找一个有交换缓存的页，丢弃它的缓存，腾出一个交换槽。
+这个页下次换出时要重新写外存
+参数：进程
+返回：腾出了1，没有交换缓存0
+*/
+int DropSwapCache(struct proc *CurrentProcess)
+{
+	struct MemoryTableEntry *CurrentEntry = CurrentProcess->MemoryListTail;
+	while (CurrentEntry != 0)
+	{
+		if (CurrentEntry->SwapSlot != SWAP_SLOT_NONE)
+		{
+			RemoveFromSwapTable(CurrentProcess, CurrentEntry->SwapSlot);
+			CurrentEntry->SwapSlot = SWAP_SLOT_NONE;
+			return 1;
+		}
+		CurrentEntry = CurrentEntry->Last;
+	}
+	return 0;
+}
+
+/*
+描述：判断一个进程的页能否被换出。init和sh不换页（见SwapPage），驻留页少于2页时内存链表不能再取表尾
+参数：进程
+返回：能1，不能0
+*/
+int CanSwapOut(struct proc *CurrentProcess)
+{
+	if (CurrentProcess->pgdir == 0 || CurrentProcess->MemoryEntryNum < 2)
+	{
+		return 0;
+	}
+	if (kstrcmp(CurrentProcess->name, "init") == 0 || kstrcmp(CurrentProcess->name, "sh") == 0)
+	{
+		return 0;
+	}
+	return 1;
+}
@@ -4,33 +4,80 @@
 */
 
 //全局变量定义
-//内存表：2个指针，340个entry，一个entry3个指针，占用4088byte内存
-//一共25个内存表，是初始化好的
-//维护一个内存链表，内存链表的每个元素就是内存表里的entry，用来进行FIFO置换
+//内存表：2个指针，1个使用计数，204个entry，一个entry4个指针加一个交换槽号，占用4092byte内存
+//内存表页随驻留页按需分配，一页满了才分配下一页，一页里的entry全部空闲时就释放这一页
+//空闲的entry用自己的Next，Last指针串成空闲链表，记录新页时直接取表头，不用扫描内存表
+//最多43页，总entry数（8772）和原来340*25的上限基本一致
+//维护一个内存链表，内存链表的每个元素就是内存表里的entry，链表构成时钟（二次机会）置换的环，表尾是时钟指针
 //每个entry存储一个虚拟地址，代表一页（4096byte）内存
-#define MEMORY_TABLE_ENTRY_NUM 340
-#define MEMORY_TABLE_LENGTH 25
+#define MEMORY_TABLE_ENTRY_NUM 204
+#define MEMORY_TABLE_LENGTH 43
 #define MEMORY_TABLE_TOTAL_ENTRYS (MEMORY_TABLE_ENTRY_NUM * MEMORY_TABLE_LENGTH)
 
-//外存交换表：2个指针，1022entry，一个entry1个指针，4096byte内存
+//外存交换表：2个指针，1个页号，960位的空闲位图，960entry，一个entry1个指针，3972byte内存
 //外存表是动态维护的
-//每个entry存储一个虚拟地址，代表一页（4096byte）内存
-#define SWAP_TABLE_ENTRY_NUM 1022
-#define SWAP_TABLE_PAGE_OFFSET (SWAP_TABLE_ENTRY_NUM * PGSIZE)
-
-//外存表entry和外存文件线性对应
-//一个外存文件最大65536bytes，相当于16个外存entry，最多6个文件，应该被初始化
-//但是，一次交换只能有1024bytes被交换
-#define SWAP_FILE_SIZE 65536
-#define SWAP_FILE_MAX_NUM 6
+//每个entry存储一个虚拟地址，代表一页（4096byte）内存，也就是一个交换槽
+//位图的第i位为1表示第i个entry正在使用，找空位时按字扫描位图而不是逐个比较entry
+#define SWAP_TABLE_ENTRY_NUM 960
+#define SWAP_TABLE_BITMAP_LENGTH (SWAP_TABLE_ENTRY_NUM / 32)
+
+//被换出的页表项：高20位存交换槽号（外存偏移 / PGSIZE），低位是PTE_W | PTE_U | PTE_PG
+//缺页时直接从页表项得到外存偏移，不用再按虚拟地址查交换表
+#define SWAP_PTE(slot) ((((uint)(slot)) << PGSHIFT) | PTE_W | PTE_U | PTE_PG)
+#define SWAP_PTE_SLOT(pte) (((uint)(pte)) >> PGSHIFT)
+
+//交换缓存：页换入之后交换槽不释放，内存表entry的SwapSlot记住这个槽，槽里的内容和内存页相同
+//换入时页表项的脏位PTE_D是0，再次换出时如果PTE_D还是0，直接释放物理页，不用写外存；脏页写回原来的槽
+//没有交换缓存的entry，SwapSlot是SWAP_SLOT_NONE；交换空间用完时先丢弃交换缓存
+#define SWAP_SLOT_NONE 0xffffffff
+
+//每个进程的驻留页上限，达到上限时换出本进程自己的页，可以调低，但不能超过内存表的容量
+//全局空闲物理页低于低水位时唤醒换出守护线程，它从所有进程里选驻留页最多的进程一批一批地回收，直到高于高水位
+//只有物理页真的用完时，分配内存的进程才自己同步回收
+#define MEMORY_RESIDENT_LIMIT MEMORY_TABLE_TOTAL_ENTRYS
+#define RECLAIM_LOW_WATERMARK 1024
+#define RECLAIM_HIGH_WATERMARK 2048
+#define RECLAIM_BATCH_SIZE 16
+
+//换入预读：缺页换入一页时，顺着地址增长方向把紧挨着的、交换槽也连续的已换出页一起换入
+//顺序访问时预读窗口加倍，最大SWAP_READ_AHEAD_MAX页，随机访问时减半，最小1页（不预读）
+#define SWAP_READ_AHEAD_MAX 16
+
+//缺页预映射（fault-around）：懒分配的堆页第一次被写时，顺着访问方向最多一共映射FAULT_AROUND_PAGES页，
+//不跨过4MB区域（一个页表）；栈增长时一次最多增长FAULT_AROUND_PAGES页。设为1就是原来一次一页
+//驻留页接近上限或者空闲物理页低于低水位时不预映射，所以预映射不会导致换出
+#define FAULT_AROUND_PAGES 8
+
+//交换空间按区段（extent）分配：一个区段65536bytes，相当于16个交换槽，槽号i在第i / SWAP_EXTENT_PAGES个区段里
+//用到新的槽时才按需增加区段（见GrowSwapSpace），区段只从裸交换区分配，没有交换文件
+//所以交换空间的大小只由裸交换区决定；每个进程的区段表是按需分配的页串成的链表，一页放SWAP_EXTENT_PAGE_ENTRY_NUM个区段
+//换入换出都是整页读写，不经过日志；只有交换空间满了、只能原地交换时才用SWAP_BUFFER_SIZE的缓冲区
+#define SWAP_EXTENT_SIZE 65536
+#define SWAP_EXTENT_PAGES (SWAP_EXTENT_SIZE / PGSIZE)
+#define SWAP_EXTENT_PAGE_ENTRY_NUM 1023
 #define SWAP_BUFFER_SIZE (PGSIZE / 4) 
 
+//压缩交换池：页写交换空间之前先压缩，压缩到半页以内就放进内存里的压缩池，不写外存，压缩不了的页照常写外存
+//压缩页挂在它的交换区段上，交换槽仍然是这一页在外存的位置，所以fork共享交换槽时压缩页也一起共享
+//池里的页按放入的先后串成链表，池占的内存超过COMPRESSED_SWAP_POOL_SIZE时，从最早放入（最冷）的页开始解压写回它的交换槽
+//设为0关闭压缩交换池
+#define COMPRESSED_SWAP_POOL_SIZE (256 * PGSIZE)
+#define COMPRESSED_CLASS_NUM 5
+
+//虚拟地址索引：每个进程一页，内存表1024个哈希桶，用页号取模作为哈希值
+//桶里是用entry的HashNext串起来的链表，这样按虚拟地址查找，删除entry都是常数时间
+//交换表不需要索引，交换槽号直接存在页表项里
+#define ADDRESS_INDEX_BUCKET_NUM 1024
+#define ADDRESS_INDEX_HASH(va) ((((uint)(va)) >> PGSHIFT) & (ADDRESS_INDEX_BUCKET_NUM - 1))
+
 //数据结构类型定义
 struct MemoryTableEntry
 {
   char *VirtualAddress;
   struct MemoryTableEntry *Next;
   struct MemoryTableEntry *Last;
+  struct MemoryTableEntry *HashNext;
+  uint SwapSlot;
 };
 
 struct SwapTableEntry
@@ -38,22 +85,103 @@ struct SwapTableEntry
   char *VirtualAddress;
 };
 
+//内存表页都是kalloc出来的整页，entry地址向下取整就是所在的页
 struct MemoryTablePage
 {
   struct MemoryTablePage *Last;
   struct MemoryTablePage *Next;
+  int UsedNum;
   struct MemoryTableEntry EntryList[MEMORY_TABLE_ENTRY_NUM];
 };
 
+//交换表页都是kalloc出来的整页，entry地址向下取整就是所在的页，再用PageNum算出外存偏移
 struct SwapTablePage
 {
   struct SwapTablePage *Last;
   struct SwapTablePage *Next;
+  int PageNum;
+  uint UsedBitmap[SWAP_TABLE_BITMAP_LENGTH];
   struct SwapTableEntry EntryList[SWAP_TABLE_ENTRY_NUM];
 };
 
+struct AddressIndex
+{
+  struct MemoryTableEntry *MemoryBucket[ADDRESS_INDEX_BUCKET_NUM];
+};
+
+//exec建新映像时旧映像的内存表和栈大小存在这里，进程用一个空的内存表记录新映像的页，
+//新映像提交之后才释放旧的内存表，失败时放回去，见SaveMemoryTable
+struct SavedMemoryTable
+{
+  struct MemoryTablePage *MemoryTableListHead;
+  struct MemoryTablePage *MemoryTableListTail;
+  struct MemoryTableEntry *MemoryListHead;
+  struct MemoryTableEntry *MemoryListTail;
+  struct MemoryTableEntry *MemoryFreeListHead;
+  struct AddressIndex *AddressIndex;
+  int MemoryEntryNum;
+  uint StackSize;
+};
+
 struct SwapTablePlace
 {
 	struct SwapTableEntry* Place;
-	int Offset;
+	uint Slot;
+};
+
+//交换区段：RawExtent是裸交换区的区段号
+//fork时子进程和父进程共享区段，Ref是区段表里有这个区段的进程数，SlotRef[i]是交换表里用着第i个槽的进程数
+//Owner是增加这个区段的进程，共享的时候只有它能在这个区段里分配空槽（见CanAllocSwapSlot），它放掉区段时清零
+//都用原子加更新。Compressed[i]是第i个槽在压缩交换池里的页，有的话槽里的内容以它为准
+struct SwapExtent
+{
+  int Ref;
+  int RawExtent;
+  struct proc *Owner;
+  int SlotRef[SWAP_EXTENT_PAGES];
+  struct CompressedPage *Compressed[SWAP_EXTENT_PAGES];
+};
+
+//区段表页：kalloc出来的整页，第i页放第i * SWAP_EXTENT_PAGE_ENTRY_NUM个区段开始的区段指针
+struct SwapExtentPage
+{
+  struct SwapExtentPage *Next;
+  struct SwapExtent *ExtentList[SWAP_EXTENT_PAGE_ENTRY_NUM];
 };
+
+//压缩页：头部后面是压缩数据，整个对象从按大小分级的slab缓存里分配，Class是级别
+//Writeback表示正在写回外存，这时它已经不在池的链表里；Dead表示写回期间槽被释放了，写回完成后直接丢掉
+struct CompressedPage
+{
+  struct CompressedPage *Next;
+  struct CompressedPage *Last;
+  struct SwapExtent *Extent;
+  int Index;
+  int Size;
+  int Class;
+  int Writeback;
+  int Dead;
+  uchar Data[];
+};
+
+//全局虚拟内存统计，用原子加更新，通过GetMemoryInfo返回给用户
+//用于在同一负载下比较不同置换策略的缺页次数和换入换出次数，SwapWriteNum是写交换空间的页数（包括放进压缩池的）
+//压缩池：CompressedStoreNum页放进了池，压缩后一共CompressedByteNum字节，CompressedRejectNum页压缩不了直接写外存，
+//换入时CompressedHitNum页从池里解压，CompressedMissNum页读外存，CompressedWritebackNum页从池里写回外存，池里现有CompressedPageNum页
+//真正写外存的页数是SwapWriteNum - CompressedStoreNum + CompressedWritebackNum
+struct VirtualMemoryStatistics
+{
+  int PageFaultNum;
+  int SwapInNum;
+  int SwapOutNum;
+  int SwapWriteNum;
+  int CompressedStoreNum;
+  int CompressedByteNum;
+  int CompressedRejectNum;
+  int CompressedHitNum;
+  int CompressedMissNum;
+  int CompressedWritebackNum;
+  int CompressedPageNum;
+};
+
+extern struct VirtualMemoryStatistics VirtualMemoryStat;
@@ -1,10 +1,27 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "meminfo.h"
 
 #define NUM_PER_CALL 1024
 #define CALLS 7359
 
+/*
+描述：读取全局的缺页，换入，换出次数和写外存的页数（见GetMemoryInfo）
+参数：存放四个计数的数组
+返回：无
+*/
+void GetSwapStatistics(unsigned int* Statistics)
+{
+    char Info[MEMORY_INFO_SIZE];
+    int i;
+    GetMemoryInfo(Info);
+    for (i = 0; i < 4; i ++)
+    {
+        Statistics[i] = MemoryInfo(Info, MI_PAGEFAULT + i);
+    }
+}
+
 void OneCall(int n)
 {
     if (n == 0)
@@ -44,8 +61,16 @@ int main()
     printf(1, "================================\n");
     printf(1, "Virtual Memory test started.\n");
 
+    unsigned int Before[4], After[4];
+    int StartTicks, Ticks;
+    GetSwapStatistics(Before);
+    StartTicks = uptime();
     OneCall(CALLS);
+    Ticks = uptime() - StartTicks;
+    GetSwapStatistics(After);
 
+    printf(1, "Page Faults: %d; Swap In: %d; Swap Out: %d; Swap Writes: %d\n", After[0] - Before[0], After[1] - Before[1], After[2] - Before[2], After[3] - Before[3]);
+    printf(1, "Ticks: %d\n", Ticks);
     printf(1, "Virtual Memory test finished.\n");
     printf(1, "================================\n");
     return 0;
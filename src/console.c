@@ -259,7 +259,10 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
+    // dst may page fault, and the fault handler can sleep.
+    release(&cons.lock);
     *dst++ = c;
+    acquire(&cons.lock);
     --n;
     if(c == '\n')
       break;
@@ -273,13 +276,19 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  int i, j, m;
+  char tmp[64];
 
+  // Copy buf out with cons.lock released: reading it may page fault.
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(tmp) ? n - i : sizeof(tmp);
+    memmove(tmp, buf + i, m);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(tmp[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
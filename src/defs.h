@@ -3,6 +3,7 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct kmemcache;
 struct proc;
 struct rtcdate;
 struct spinlock;
@@ -10,7 +11,11 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct MemoryTableEntry;
+struct MemoryTablePage;
+struct SwapTableEntry;
 struct SwapTablePlace;
+struct SwapExtent;
+struct SavedMemoryTable;
 
 // bio.c
 void            binit(void);
@@ -60,6 +65,7 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -71,6 +77,12 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kalloclarge(void);
+char*           kalloczeroed(void);
+char*           kallocorder(int);
+void            kfreeorder(char*, int);
+void            kzerofill(void);
+void            kfreelarge(char*);
 uint            getPhysicalPageRefCount(uint physicalAddr);
 void            increasePhysicalPageRefCountByOne(uint physicalAddr);
 void            decreasePhysicalPageRefCountByOne(uint physicalAddr);
@@ -102,6 +114,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -127,12 +140,22 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 void            InitVirtualMemoryData(void);
+void            LockVirtualMemory(struct proc*);
+void            UnlockVirtualMemory(struct proc*);
+int             ReclaimMemory(int);
+void            StartPageOutDaemon(void);
+void            WakePageOutDaemon(void);
 
 
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+void            kmemcacheinit(struct kmemcache*, char*, uint);
+void*           kmemcachealloc(struct kmemcache*);
+void            kmemcachefree(struct kmemcache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -196,6 +219,7 @@ char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 int             stackGrow(pde_t*);
+int             allocustack(pde_t*);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
@@ -205,26 +229,71 @@ void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 void            PageFault(uint);
+void            InitZeroPage(void);
+void            HandlePageFault(uint, uint);
+struct SwapTablePlace GetBackedSwapSlot(struct proc*, uint);
+struct MemoryTableEntry* DetachVictimPage(struct proc*, uint*, uint*);
+void            WriteBackVictimPages(struct proc*, uint*, uint*, int);
+char*           AllocUserPage(uint);
+int             NeedSwapOwnPage(struct proc*);
+int             RecordPage(char*);
+int             RecordMemoryRange(uint, uint);
+int             SwapOnePage(uint, struct proc*);
+void            SwapReadAhead(uint, uint, struct proc*);
+int             CanFaultAround(struct proc*);
+void            FaultAround(struct proc*, uint);
+int             RecordNewPage(char*);
 
 //fs.c 虚拟内存读写
-int InitializeSwapFiles(struct proc *p);
+void InitializeSwapArea(void);
+int GrowSwapSpace(struct proc *p, uint slot);
+int ShareSwapSpace(struct proc *to, struct proc *from);
+void WriteSwapPages(struct proc *p, char **pages, uint slot, int num);
+void HoldSwapSlot(struct proc *p, uint slot);
+void ReleaseSwapSlot(struct proc *p, uint slot);
+int IsSwapSlotShared(struct proc *p, uint slot);
+int CanAllocSwapSlot(struct proc *p, uint slot);
 int ClearSwapFiles(struct proc *p);
 int ReadSwapFile(struct proc *p, char *buf, uint offset, uint size);
 int WriteSwapFile(struct proc *p, char *buf, uint offset, uint size);
+void WriteSwapExtent(struct SwapExtent *e, char *page, uint off);
 
 // VirtualMemory.c
+void AddToMemoryIndex(struct proc*, struct MemoryTableEntry*);
+void RemoveFromMemoryIndex(struct proc*, struct MemoryTableEntry*);
+void SetSwapTableEntry(struct proc*, struct SwapTableEntry*, char*);
+struct SwapTablePlace GetSwapTablePlace(struct SwapTableEntry*);
 struct MemoryTableEntry* GetMemoryListTail(struct proc*);
 void SetMemoryListHead(struct proc *CurrentProcess, struct MemoryTableEntry*, char*);
 void RemoveFromMemoryList(struct proc*, struct MemoryTableEntry*);
 struct MemoryTableEntry* GetAddressInMemoryTable(struct proc*, char*);
 struct SwapTablePlace GetEmptyInSwapTable(struct proc*);
-struct SwapTablePlace GetAddressInSwapTable(struct proc*, char*);
-void RemoveFromSwapTable(struct proc*, char*);
-void AllocMemoryTable(struct proc *);
+uint GetEmptySwapRun(struct proc*, int);
+struct SwapTablePlace GetEmptySlotInSwapTable(struct proc*, uint);
+struct SwapTableEntry* GetSlotInSwapTable(struct proc*, uint);
+void RemoveFromSwapTable(struct proc*, uint);
+struct MemoryTablePage *GrowMemoryTable(struct proc *);
+void FreeMemoryEntry(struct proc*, struct MemoryTableEntry*);
+void AddToMemoryFreeList(struct proc*, struct MemoryTableEntry*);
+void RemoveFromMemoryFreeList(struct proc*, struct MemoryTableEntry*);
+struct MemoryTableEntry* GetFreeMemoryEntry(struct proc*);
 int GrowSwapTable(struct proc*);
 void ClearSwapTable(struct proc*);
 void ClearMemoryTable(struct proc*);
+void SaveMemoryTable(struct proc*, struct SavedMemoryTable*);
+void RestoreMemoryTable(struct proc*, struct SavedMemoryTable*);
+void FreeSavedMemoryTable(struct SavedMemoryTable*);
 int CopyVirtualMemoryData(struct proc *, struct proc *);
+int CanSwapOut(struct proc*);
+int DropSwapCache(struct proc*);
+
+//CompressedSwap.c
+void InitializeCompressedSwap(void);
+int StoreCompressedPage(struct SwapExtent*, int, char*);
+int LoadCompressedPage(struct SwapExtent*, int, char*);
+void DropCompressedPage(struct SwapExtent*, int);
+void FlushCompressedPage(struct SwapExtent*, int);
+void ReleaseCompressedPages(struct SwapExtent*);
 
 //SharedMemory.c
 void InitGlobalSharedMemory(void);
@@ -238,6 +307,8 @@ int GetProcessSharedMemoryInfo(struct proc*);
 //proc中的内存信息获取函数
 void GetMemoryInfo(char*);
 int GetPhysicalPageTotal();
+int GetFreePageNum();
+int GetFreeBlockNum(int);
 
 
 // number of elements in fixed-size array
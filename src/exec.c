@@ -11,12 +11,13 @@ int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, locked;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct SavedMemoryTable oldtable;
   struct proc *curproc = myproc();
 
   begin_op();
@@ -28,6 +29,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  locked = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +40,12 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  ClearMemoryTable(curproc);
-  ClearSwapTable(curproc);
+  // The new image is recorded in an empty memory table while the old
+  // one is kept in oldtable, so a failed exec returns to an intact old
+  // image. Keep global reclaim away until the image is committed.
+  LockVirtualMemory(curproc);
+  SaveMemoryTable(curproc, &oldtable);
+  locked = 1;
 
   // Load program into memory.
   
@@ -54,12 +60,16 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    // Only allocate the pages holding file data. Whole bss pages are
+    // left unmapped and filled by PageFault on first touch.
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.filesz)) == 0)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
+    if(sz < ph.vaddr + ph.memsz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -69,11 +79,8 @@ exec(char *path, char **argv)
   sz = PGROUNDUP(sz);
 
   // get a page to user stack by default.
-  curproc->stackSize = 0;
-  int growResult = stackGrow(pgdir);
-  if (growResult == 0) {
+  if(allocustack(pgdir) < 0)
     goto bad;
-  }
   sp = USERTOP;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -104,21 +111,27 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
+  curproc->LargePageNum = 0;
   curproc->sz = sz;
   curproc->stackSize = PGSIZE;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
 
   ClearSwapFiles(curproc);
-  InitializeSwapFiles(curproc);
 
   switchuvm(curproc);
   freevm(oldpgdir);
+  FreeSavedMemoryTable(&oldtable);
+  UnlockVirtualMemory(curproc);
   return 0;
 
  bad:
   if(pgdir)
     freevm(pgdir);
+  if(locked){
+    RestoreMemoryTable(curproc, &oldtable);
+    UnlockVirtualMemory(curproc);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
@@ -14,6 +14,7 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -21,6 +22,7 @@
 #include "buf.h"
 #include "file.h"
 #include "fcntl.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -182,9 +184,9 @@ iinit(int dev)
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d swap start %d nswap %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.swapstart, sb.nswap);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -671,104 +673,393 @@ nameiparent(char *path, char *name)
   return namex(path, 1, name);
 }
 
+// Swap space. A process's swap slots live in extents of SWAP_EXTENT_SIZE
+// bytes, added on demand by GrowSwapSpace as higher slots come into use.
+// A process starts with no extents; the first one is set up when it
+// first evicts a page, so processes that never swap cost nothing here.
+// Extents are taken from the raw swap blocks after the file system, the
+// only backing store; there is no swap file. They go to the disk through
+// iderwv, bypassing the buffer cache and the log, using groups of
+// NSWAPBUF private bufs. Extents are reference counted and
+// shared between a parent and its children, see ShareSwapSpace.
+struct kmemcache swapextentcache;
+
+// Raw extents in use. The lock is taken with ptable.lock held (see
+// ReclaimMemory) and must not be held across anything else.
+struct {
+  struct spinlock lock;
+  uchar used[NSWAPEXTENT];
+} swapspace;
 
-int InitializeSwapFiles(struct proc *CurrentProcess)
+// Raw swap I/O goes through groups of NSWAPBUF private bufs, so that
+// one request can queue many blocks at once (see iderwv).
+struct swapio {
+  int busy;
+  struct buf buf[NSWAPBUF];
+};
+
+struct {
+  struct spinlock lock;
+  struct swapio io[NSWAPIO];
+} swapiopool;
+
+void InitializeSwapArea(void)
 {
+  int i, j;
 
+  if (SWAPEXTENTSIZE * BSIZE != SWAP_EXTENT_SIZE)
+    panic("InitializeSwapArea: extent size");
+  initlock(&swapspace.lock, "swapspace");
+  initlock(&swapiopool.lock, "swapio");
+  kmemcacheinit(&swapextentcache, "swapextent", sizeof(struct SwapExtent));
+  for (i = 0; i < NSWAPIO; i++)
+    for (j = 0; j < NSWAPBUF; j++)
+      initsleeplock(&swapiopool.io[i].buf[j].lock, "swapbuf");
+}
 
-  int i;
-  for (i = 0; i < SWAP_FILE_MAX_NUM; i++)
+// The number of raw extents comes from the superblock, which iinit has
+// read before the first fork.
+static int AllocRawExtent(void)
+{
+  int i, n;
+
+  n = sb.nswap / SWAPEXTENTSIZE;
+  if (n > NSWAPEXTENT)
+    n = NSWAPEXTENT;
+  acquire(&swapspace.lock);
+  for (i = 0; i < n; i++)
   {
-    char path[20];
-    struct inode *in;
+    if (!swapspace.used[i])
+    {
+      swapspace.used[i] = 1;
+      release(&swapspace.lock);
+      return i;
+    }
+  }
+  release(&swapspace.lock);
+  return -1;
+}
 
-    memmove(path, "./.swap", 7);
-    itoa(i, path + 7);
-    itoa(CurrentProcess->pid, path + 8);
+static void FreeRawExtent(int extent)
+{
+  acquire(&swapspace.lock);
+  swapspace.used[extent] = 0;
+  release(&swapspace.lock);
+}
 
-    begin_op();
-    in = create(path, T_FILE, 0, 0);
-    iunlock(in);
+static struct swapio* GetSwapIO(void)
+{
+  struct swapio *io;
+  int i;
 
-    CurrentProcess->FilesForSwap[i] = filealloc();
-    if (CurrentProcess->FilesForSwap[i] == 0)
+  acquire(&swapiopool.lock);
+  for (;;)
+  {
+    for (io = swapiopool.io; io < &swapiopool.io[NSWAPIO]; io++)
     {
-      panic("[ERROR] Alloc File for Swapping Fail!");
+      if (!io->busy)
+      {
+        io->busy = 1;
+        release(&swapiopool.lock);
+        for (i = 0; i < NSWAPBUF; i++)
+          acquiresleep(&io->buf[i].lock);
+        return io;
+      }
     }
-    CurrentProcess->FilesForSwap[i]->ip = in;
-    CurrentProcess->FilesForSwap[i]->type = FD_INODE;
-    CurrentProcess->FilesForSwap[i]->off = 0;
-    CurrentProcess->FilesForSwap[i]->readable = O_WRONLY;
-    CurrentProcess->FilesForSwap[i]->writable = O_RDWR;
-    end_op();
+    sleep(&swapiopool, &swapiopool.lock);
   }
+}
 
+static void PutSwapIO(struct swapio *io)
+{
+  int i;
 
-  return 0;
+  for (i = 0; i < NSWAPBUF; i++)
+    releasesleep(&io->buf[i].lock);
+  acquire(&swapiopool.lock);
+  io->busy = 0;
+  wakeup(&swapiopool);
+  release(&swapiopool.lock);
 }
 
-int ClearSwapFiles(struct proc *CurrentProcess)
+// Read or write size bytes at offset off of a raw extent, without
+// journaling. The memory is given as a list of pages: byte n is at
+// pages[n / PGSIZE] + n % PGSIZE. Blocks are sequential on disk and are
+// queued NSWAPBUF at a time, so the disk streams them back to back.
+static void RawExtentRW(int extent, char **pages, uint off, uint size, int write)
 {
+  struct swapio *io;
+  struct buf *bs[NSWAPBUF], *b;
+  uint n, m;
+  int i, k;
+
+  if (off % BSIZE != 0 || size % BSIZE != 0 || off + size > SWAP_EXTENT_SIZE)
+    panic("RawExtentRW");
+  io = GetSwapIO();
+  for (n = 0; n < size; n += k * BSIZE)
+  {
+    for (k = 0; k < NSWAPBUF && n + k * BSIZE < size; k++)
+    {
+      m = n + k * BSIZE;
+      b = bs[k] = &io->buf[k];
+      b->dev = ROOTDEV;
+      b->blockno = sb.swapstart + extent * SWAPEXTENTSIZE + (off + m) / BSIZE;
+      if (write)
+      {
+        memmove(b->data, pages[m / PGSIZE] + m % PGSIZE, BSIZE);
+        b->flags = B_DIRTY;
+      }
+      else
+        b->flags = 0;
+    }
+    iderwv(bs, k);
+    if (!write)
+    {
+      for (i = 0; i < k; i++)
+      {
+        m = n + i * BSIZE;
+        memmove(pages[m / PGSIZE] + m % PGSIZE, bs[i]->data, BSIZE);
+      }
+    }
+  }
+  PutSwapIO(io);
+}
 
-  int i;
-  //int ret = 0;
-  for (i = 0; i < SWAP_FILE_MAX_NUM; i++)
+static void PutSwapExtent(struct SwapExtent *e)
+{
+  if (xadd(&e->Ref, -1) != 1)
+    return;
+  ReleaseCompressedPages(e);
+  FreeRawExtent(e->RawExtent);
+  kmemcachefree(&swapextentcache, e);
+}
+
+// A process's extent list is a chain of pages holding
+// SWAP_EXTENT_PAGE_ENTRY_NUM extent pointers each, added as the list
+// grows, so its length is bounded only by the raw swap area. Returns
+// where extent n is kept, or 0 if that page does not exist and alloc is
+// not set or no page is left.
+static struct SwapExtent** GetExtentPlace(struct proc *CurrentProcess, uint n, int alloc)
+{
+  struct SwapExtentPage **pp = &CurrentProcess->SwapExtentListHead;
+
+  for (;;)
   {
-    char path[20];
+    if (*pp == 0 && (!alloc || (*pp = (struct SwapExtentPage*)kalloczeroed()) == 0))
+      return 0;
+    if (n < SWAP_EXTENT_PAGE_ENTRY_NUM)
+      return &(*pp)->ExtentList[n];
+    n -= SWAP_EXTENT_PAGE_ENTRY_NUM;
+    pp = &(*pp)->Next;
+  }
+}
 
-    memmove(path, "./.swap", 7);
-    itoa(i, path + 7);
-    itoa(CurrentProcess->pid, path + 8);
+// Back swap slot slot, adding extents up to the one that holds it, or
+// as many as there is room for. Never sleeps, so it may be called with
+// ptable.lock held. Returns 1 if the slot is backed, 0 if swap space ran
+// out.
+int GrowSwapSpace(struct proc *CurrentProcess, uint slot)
+{
+  struct SwapExtent *e, **place;
+  uint n = slot / SWAP_EXTENT_PAGES;
 
-    if (CurrentProcess->FilesForSwap[i] == 0)
+  while (CurrentProcess->SwapExtentNum <= n)
+  {
+    if ((place = GetExtentPlace(CurrentProcess, CurrentProcess->SwapExtentNum, 1)) == 0)
+      return 0;
+    if ((e = (struct SwapExtent*)kmemcachealloc(&swapextentcache)) == 0)
+      return 0;
+    memset(e, 0, sizeof(*e));
+    e->Ref = 1;
+    e->Owner = CurrentProcess;
+    if ((e->RawExtent = AllocRawExtent()) < 0)
     {
-      return -1;
-      //ret = -1;
-      //continue;
+      kmemcachefree(&swapextentcache, e);
+      return 0;
     }
-    fileclose(CurrentProcess->FilesForSwap[i]);
+    *place = e;
+    CurrentProcess->SwapExtentNum++;
+  }
+  return 1;
+}
 
-    if (kunlink(path) == -1)
+// Drop the process's slot references (its swap table) and its extents,
+// and give the extent list pages back to kalloc. Extents it owns that
+// other processes still share are left without an owner.
+int ClearSwapFiles(struct proc *CurrentProcess)
+{
+  struct SwapExtentPage *page, *next;
+  int i, j;
+
+  ClearSwapTable(CurrentProcess);
+  i = 0;
+  for (page = CurrentProcess->SwapExtentListHead; page != 0; page = next)
+  {
+    for (j = 0; j < SWAP_EXTENT_PAGE_ENTRY_NUM && i < CurrentProcess->SwapExtentNum; j++, i++)
     {
-      //ret = -1;
-      return -1;
+      if (page->ExtentList[j]->Owner == CurrentProcess)
+        page->ExtentList[j]->Owner = 0;
+      PutSwapExtent(page->ExtentList[j]);
     }
+    next = page->Next;
+    kfree((char*)page);
   }
-
-
+  CurrentProcess->SwapExtentListHead = 0;
+  CurrentProcess->SwapExtentNum = 0;
   return 0;
-  //return ret;
 }
 
-int ReadSwapFile(struct proc *CurrentProcess, char *TheBuffer, uint FileOffsetTotal, uint ReadSize)
+// fork: the child shares every extent of the parent instead of copying
+// it. Slots are then shared copy on write: CopyVirtualMemoryData takes a
+// reference on each slot the parent uses, a shared slot is never written
+// (see IsSwapSlotShared), and while an extent is shared only its owner
+// allocates new slots in it (see CanAllocSwapSlot). Returns -1 if the
+// child's extent list cannot be allocated.
+int ShareSwapSpace(struct proc *to, struct proc *from)
 {
+  struct SwapExtent **place;
+  int i;
 
-  int FileNumber = FileOffsetTotal / SWAP_FILE_SIZE;
-  if (FileNumber < 0 || FileNumber > SWAP_FILE_MAX_NUM)
+  ClearSwapFiles(to);
+  for (i = 0; i < from->SwapExtentNum; i++)
   {
-    panic("[ERROR] Illegal file read offset!");
+    if ((place = GetExtentPlace(to, i, 1)) == 0)
+      return -1;
+    *place = *GetExtentPlace(from, i, 0);
+    xadd(&(*place)->Ref, 1);
+    to->SwapExtentNum++;
   }
-  int Offset = FileOffsetTotal % SWAP_FILE_SIZE;
-  CurrentProcess->FilesForSwap[FileNumber]->off = Offset;
+  return 0;
+}
+
+static struct SwapExtent* GetSlotExtent(struct proc *CurrentProcess, uint slot)
+{
+  uint n = slot / SWAP_EXTENT_PAGES;
+
+  if (n >= CurrentProcess->SwapExtentNum)
+    return 0;
+  return *GetExtentPlace(CurrentProcess, n, 0);
+}
+
+// A process takes a reference on a slot when the slot's bit is set in
+// its swap table, and drops it when the bit is cleared. The slot's
+// compressed copy goes away with the last reference.
+void HoldSwapSlot(struct proc *CurrentProcess, uint slot)
+{
+  struct SwapExtent *e = GetSlotExtent(CurrentProcess, slot);
+
+  if (e == 0)
+    panic("HoldSwapSlot");
+  xadd(&e->SlotRef[slot % SWAP_EXTENT_PAGES], 1);
+}
+
+void ReleaseSwapSlot(struct proc *CurrentProcess, uint slot)
+{
+  struct SwapExtent *e = GetSlotExtent(CurrentProcess, slot);
+
+  if (e == 0)
+    panic("ReleaseSwapSlot");
+  if (xadd(&e->SlotRef[slot % SWAP_EXTENT_PAGES], -1) == 1)
+    DropCompressedPage(e, slot % SWAP_EXTENT_PAGES);
+}
 
+// A slot another process still refers to must not be written.
+int IsSwapSlotShared(struct proc *CurrentProcess, uint slot)
+{
+  struct SwapExtent *e = GetSlotExtent(CurrentProcess, slot);
 
+  return e != 0 && e->SlotRef[slot % SWAP_EXTENT_PAGES] > 1;
+}
 
-  return fileread(CurrentProcess->FilesForSwap[FileNumber], TheBuffer, ReadSize);
+// Only one process allocates free slots in an extent, so two processes
+// never allocate the same slot: the only process using it, or while it is
+// shared, the process that added it (its Owner). The owner's swap table
+// does not show the slots its children still hold, so in a shared extent
+// a slot is free only if no process holds it. An extent that does not
+// exist yet will be private.
+int CanAllocSwapSlot(struct proc *CurrentProcess, uint slot)
+{
+  struct SwapExtent *e = GetSlotExtent(CurrentProcess, slot);
+
+  if (e == 0 || e->Ref == 1)
+    return 1;
+  return e->Owner == CurrentProcess && e->SlotRef[slot % SWAP_EXTENT_PAGES] == 0;
 }
 
-int WriteSwapFile(struct proc *CurrentProcess, char *TheBuffer, uint FileOffsetTotal, uint ReadSize)
+// Read or write within one extent, on the disk.
+static int SwapExtentRW(struct SwapExtent *e, char *buf, uint off, uint size, int write)
 {
+  RawExtentRW(e->RawExtent, &buf, off, size, write);
+  return size;
+}
 
-  int FileNumber = FileOffsetTotal / SWAP_FILE_SIZE;
+// Write back a page from the compressed swap pool.
+void WriteSwapExtent(struct SwapExtent *e, char *page, uint off)
+{
+  SwapExtentRW(e, page, off, PGSIZE, 1);
+}
+
+// Swap space is read and written at most a page at a time, within one
+// extent. Whole pages go through the compressed swap pool first (see
+// CompressedSwap.c); a partial page access writes the slot's compressed
+// copy back to the disk before going there itself.
+int ReadSwapFile(struct proc *CurrentProcess, char *TheBuffer, uint FileOffsetTotal, uint ReadSize)
+{
+  uint ExtentNumber = FileOffsetTotal / SWAP_EXTENT_SIZE;
+  uint Offset = FileOffsetTotal % SWAP_EXTENT_SIZE;
 
-  if (FileNumber < 0 || FileNumber > SWAP_FILE_MAX_NUM)
+  if (ExtentNumber >= CurrentProcess->SwapExtentNum || ReadSize > PGSIZE || Offset + ReadSize > SWAP_EXTENT_SIZE)
   {
-    panic("[ERROR] Illegal file write offset!");
+    panic("[ERROR] Illegal file read offset!");
   }
+  struct SwapExtent *e = *GetExtentPlace(CurrentProcess, ExtentNumber, 0);
+  if (ReadSize == PGSIZE && LoadCompressedPage(e, Offset / PGSIZE, TheBuffer))
+    return ReadSize;
+  if (ReadSize < PGSIZE)
+    FlushCompressedPage(e, Offset / PGSIZE);
+  return SwapExtentRW(e, TheBuffer, Offset, ReadSize, 0);
+}
 
-  int Offset = FileOffsetTotal % SWAP_FILE_SIZE;
-  CurrentProcess->FilesForSwap[FileNumber]->off = Offset;
+int WriteSwapFile(struct proc *CurrentProcess, char *TheBuffer, uint FileOffsetTotal, uint WriteSize)
+{
+  uint ExtentNumber = FileOffsetTotal / SWAP_EXTENT_SIZE;
+  uint Offset = FileOffsetTotal % SWAP_EXTENT_SIZE;
 
+  if (ExtentNumber >= CurrentProcess->SwapExtentNum || WriteSize > PGSIZE || Offset + WriteSize > SWAP_EXTENT_SIZE)
+  {
+    panic("[ERROR] Illegal file write offset!");
+  }
+  struct SwapExtent *e = *GetExtentPlace(CurrentProcess, ExtentNumber, 0);
+  if (WriteSize == PGSIZE && StoreCompressedPage(e, Offset / PGSIZE, TheBuffer))
+    return WriteSize;
+  if (WriteSize < PGSIZE)
+    FlushCompressedPage(e, Offset / PGSIZE);
+  return SwapExtentRW(e, TheBuffer, Offset, WriteSize, 1);
+}
 
-  return filewrite(CurrentProcess->FilesForSwap[FileNumber], TheBuffer, ReadSize);
-}
\ No newline at end of file
+// Write num pages to the consecutive slots starting at slot. Pages the
+// compressed swap pool takes are not written; each run of the others
+// within an extent goes out as one sequential request.
+void WriteSwapPages(struct proc *CurrentProcess, char **pages, uint slot, int num)
+{
+  struct SwapExtent *e;
+  int i, j, stored;
+
+  for (i = 0; i < num; i = j)
+  {
+    if ((e = GetSlotExtent(CurrentProcess, slot + i)) == 0)
+      panic("[ERROR] Illegal file write offset!");
+    stored = 0;
+    for (j = i; j < num; j++)
+    {
+      if (j > i && (slot + j) % SWAP_EXTENT_PAGES == 0)
+        break;
+      if ((stored = StoreCompressedPage(e, (slot + j) % SWAP_EXTENT_PAGES, pages[j])) != 0)
+        break;
+    }
+    if (j > i)
+      RawExtentRW(e->RawExtent, pages + i, ((slot + i) % SWAP_EXTENT_PAGES) * PGSIZE, (j - i) * PGSIZE, 1);
+    if (stored)
+      j++;
+  }
+}
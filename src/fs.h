@@ -7,7 +7,10 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                                          free bit map | data blocks | raw swap]
+//
+// The raw swap blocks follow the file system (size blocks) and are not
+// in the free bit map; they are read and written without the log.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -19,6 +22,8 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first raw swap block
+  uint nswap;        // Number of raw swap blocks
 };
 
 #define NDIRECT 12
@@ -75,7 +75,7 @@ idestart(struct buf *b)
 {
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= FSSIZE + SWAPSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
@@ -164,5 +164,50 @@ iderw(struct buf *b)
   }
 
 
+  release(&idelock);
+}
+
+// Sync n bufs with disk like iderw, but queue them all at once so the
+// disk goes from one straight to the next. The queue is served in
+// order, so the caller sleeps only on the last buf and is not woken in
+// between; the others are checked once it is done. Callers pass blocks
+// in disk order.
+void
+iderwv(struct buf **bs, int n)
+{
+  struct buf **pp;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("iderwv: buf not locked");
+    if((bs[i]->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderwv: nothing to do");
+    if(bs[i]->dev != 0 && !havedisk1)
+      panic("iderwv: ide disk 1 not present");
+  }
+  if(n == 0)
+    return;
+
+  acquire(&idelock);
+
+  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
+    ;
+  for(i = 0; i < n; i++){
+    bs[i]->qnext = 0;
+    *pp = bs[i];
+    pp = &bs[i]->qnext;
+  }
+
+  if(idequeue == bs[0])
+    idestart(bs[0]);
+
+  while((bs[n-1]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(bs[n-1], &idelock);
+  for(i = 0; i < n-1; i++){
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(bs[i], &idelock);
+  }
+
   release(&idelock);
 }
@@ -8,28 +8,219 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
 
-int PhysicalPageTotal = 0;
+int PhysicalPageTotal = 0;   // updated with xadd, magazines change it without kmem.lock
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;            // only used on the buddy free lists
 };
 
+// Free memory is kept by a buddy allocator: freelist[k] holds free
+// blocks of 2^k pages, aligned to their size in physical memory.
+// BlockOrder[pfn] is k+1 when a free block of order k starts at page
+// pfn and 0 otherwise, so a freed block finds its free buddy
+// (pfn ^ 2^k) in constant time and they are merged into one block.
+// PhisicalPageRefCount is only changed with atomic instructions
+// (xadd, cmpxchg), never under kmem.lock.
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  int FreeBlockNum[MAXORDER+1];
+  uchar BlockOrder[PHYSTOP >> PGSHIFT];
+  int FreePageNum;             // number of free pages, zeroed ones included
+  struct run *zeroedlist;      // free pages already zeroed, see kzerofill
+  int ZeroedPageNum;
   uint PhisicalPageRefCount[PHYSTOP >> PGSHIFT];
 } kmem;
 
+// Per-CPU magazines of free pages. kalloc and kfree work on the
+// current CPU's magazine with interrupts off instead of taking
+// kmem.lock, and move NCPUPAGE/2 pages at a time between it and
+// the buddy allocator when it runs empty or full. kalloczeroed does
+// the same with zeroedlist, refilled from kmem.zeroedlist.
+struct kmagazine {
+  struct run *freelist;
+  int FreePageNum;
+  struct run *zeroedlist;      // already zeroed pages, see kalloczeroed
+  int ZeroedPageNum;
+} kmagazine[NCPU];
+
+// Before kinit2() only the boot CPU allocates, and mycpu() may not
+// work yet (mpinit has not run), so magazine 0 is used directly.
+static struct kmagazine*
+getmagazine(void)
+{
+  if(!kmem.use_lock)
+    return &kmagazine[0];
+  pushcli();
+  return &kmagazine[cpuid()];
+}
+
+static void
+putmagazine(void)
+{
+  if(kmem.use_lock)
+    popcli();
+}
+
+// The buddy functions below are called with kmem.lock held.
+static void
+buddypush(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.FreeBlockNum[order] ++;
+  kmem.BlockOrder[V2P(r) >> PGSHIFT] = order + 1;
+}
+
+static void
+buddyremove(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.FreeBlockNum[order] --;
+  kmem.BlockOrder[V2P(r) >> PGSHIFT] = 0;
+}
+
+// Take a block of 2^order pages, splitting the smallest larger free
+// block when there is none of that order.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  buddyremove(r, k);
+  // Keep the lower half, give back the upper one.
+  while(k > order){
+    k--;
+    buddypush((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  kmem.FreePageNum -= 1 << order;
+  return r;
+}
+
+// Give back a block of 2^order pages, merging it with its buddy for
+// as long as the buddy is free too.
+static void
+buddyfree(struct run *r, int order)
+{
+  uint pfn = V2P(r) >> PGSHIFT;
+  uint buddy;
+
+  kmem.FreePageNum += 1 << order;
+  for(; order < MAXORDER; order++){
+    buddy = pfn ^ (1 << order);
+    if(buddy >= (PHYSTOP >> PGSHIFT) || kmem.BlockOrder[buddy] != order + 1)
+      break;
+    buddyremove((struct run*)P2V(buddy << PGSHIFT), order);
+    pfn &= ~(1 << order);
+  }
+  buddypush((struct run*)P2V(pfn << PGSHIFT), order);
+}
+
+// Move up to n pages from kmem's lists to magazine m.
+static void
+krefill(struct kmagazine *m, int n)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  for(; n > 0; n--){
+    if((r = buddyalloc(0)) == 0){
+      if((r = kmem.zeroedlist) == 0)
+        break;
+      kmem.zeroedlist = r->next;
+      kmem.ZeroedPageNum --;
+      kmem.FreePageNum --;
+    }
+    r->next = m->freelist;
+    m->freelist = r;
+    m->FreePageNum ++;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Move up to n pages from the zeroed pool to magazine m's zeroed list.
+static void
+kzerorefill(struct kmagazine *m, int n)
+{
+  struct run *r;
+
+  // Before kinit2() kzerofill has not run, so the pool is empty.
+  if(!kmem.use_lock || kmem.zeroedlist == 0)
+    return;
+  acquire(&kmem.lock);
+  for(; n > 0 && (r = kmem.zeroedlist) != 0; n--){
+    kmem.zeroedlist = r->next;
+    kmem.ZeroedPageNum --;
+    kmem.FreePageNum --;
+    r->next = m->zeroedlist;
+    m->zeroedlist = r;
+    m->ZeroedPageNum ++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from magazine m back to the buddy allocator.
+static void
+kdrain(struct kmagazine *m, int n)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  for(; n > 0 && (r = m->freelist) != 0; n--){
+    m->freelist = r->next;
+    m->FreePageNum --;
+    buddyfree(r, 0);
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
 int _physicalAddrInvalid(uint physicalAddr) {
   uint PHYSTART = V2P(end);
   return physicalAddr < PHYSTART || physicalAddr >= PHYSTOP;
 }
 
+// Atomically drop one reference to the page at physicalAddr and
+// return how many are left. A count that is already 0 (pages handed
+// in by freerange) stays 0.
+static uint
+krefdrop(uint physicalAddr)
+{
+  volatile uint *count = &kmem.PhisicalPageRefCount[physicalAddr >> PGSHIFT];
+  uint old;
+
+  do {
+    old = *count;
+    if(old == 0)
+      return 0;
+  } while(cmpxchg(count, old, old - 1) != old);
+  return old - 1;
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -73,30 +264,29 @@ void
 kfree(char *v)
 {
   uint physicalAddr = V2P(v);
-  uint physicalPageIdx = physicalAddr >> PGSHIFT;
-
   int addrNoAlignToPage = (uint)physicalAddr % PGSIZE;
   int addrInvalid = _physicalAddrInvalid(physicalAddr);
   if(addrNoAlignToPage || addrInvalid)
     panic("kfree");
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   ///////Start kfree main work.
   struct run *r;
+  struct kmagazine *m;
   r = (struct run*)v;
-  if (kmem.PhisicalPageRefCount[physicalPageIdx] > 0) {
-    kmem.PhisicalPageRefCount[physicalPageIdx] -= 1;
-  } else if (kmem.PhisicalPageRefCount[physicalPageIdx] == 0) {
-    memset(v, 1, PGSIZE);
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-    PhysicalPageTotal --;
-  }
+  // Drop one reference; the page goes back to the freelist with the
+  // last one. Only the caller that drops the last reference sees 0.
+  if (krefdrop(physicalAddr) > 0)
+    return;
+  memset(v, 1, PGSIZE);
+  m = getmagazine();
+  r->next = m->freelist;
+  m->freelist = r;
+  m->FreePageNum ++;
+  if(m->FreePageNum > NCPUPAGE)
+    kdrain(m, NCPUPAGE / 2);
+  putmagazine();
+  xadd(&PhysicalPageTotal, -1);
   ///////End kfree main work.
-  if(kmem.use_lock)
-    release(&kmem.lock);
-
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -105,33 +295,176 @@ kfree(char *v)
 char*
 kalloc(void)
 {
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   ///////Start kalloc main work.
   struct run *r;
-  r = kmem.freelist;
+  struct kmagazine *m;
+  m = getmagazine();
+  if(m->freelist == 0)
+    krefill(m, NCPUPAGE / 2);
+  r = m->freelist;
+  if(r){
+    m->freelist = r->next;
+    m->FreePageNum --;
+  } else if((r = m->zeroedlist) != 0){
+    m->zeroedlist = r->next;
+    m->ZeroedPageNum --;
+  }
+  putmagazine();
   if(r){
-    kmem.freelist = r->next;
     kmem.PhisicalPageRefCount[V2P((char*)r) >> PGSHIFT] = 1;
-    PhysicalPageTotal ++;
+    xadd(&PhysicalPageTotal, 1);
   }
   ///////End kalloc main work.
-  if(kmem.use_lock)
+
+  return (char*)r;
+}
+
+// 4MB pages for large user heap mappings are order MAXORDER blocks
+// of the buddy allocator. A large page is reference counted on its
+// first 4KB frame, so the refcount helpers below work on it as well.
+// Returns 0 if there is no free block that large.
+char*
+kalloclarge(void)
+{
+  char *v;
+
+  if((PGSIZE << MAXORDER) != LARGEPGSIZE)
+    panic("kalloclarge");
+  if((v = kallocorder(MAXORDER)) != 0)
+    kmem.PhisicalPageRefCount[V2P(v) >> PGSHIFT] = 1;
+  return v;
+}
+
+// Drop one reference to a 4MB page, giving it back to the buddy
+// allocator with the last one.
+void
+kfreelarge(char *v)
+{
+  if(V2P(v) % LARGEPGSIZE || _physicalAddrInvalid(V2P(v)))
+    panic("kfreelarge");
+
+  if (krefdrop(V2P(v)) > 0)
+    return;
+  kfreeorder(v, MAXORDER);
+}
+
+// Allocate one 4096-byte page filled with zeros. Takes a page from
+// this CPU's zeroed list, refilled from the zeroed pool NCPUPAGE/2
+// pages at a time, so usually neither kmem.lock nor a memset is
+// needed. Otherwise it zeroes an ordinary page itself.
+char*
+kalloczeroed(void)
+{
+  struct run *r;
+  struct kmagazine *m;
+  int zeroed;
+
+  m = getmagazine();
+  if(m->zeroedlist == 0)
+    kzerorefill(m, NCPUPAGE / 2);
+  zeroed = (m->zeroedlist != 0);
+  if(zeroed){
+    r = m->zeroedlist;
+    m->zeroedlist = r->next;
+    m->ZeroedPageNum --;
+  } else {
+    if(m->freelist == 0)
+      krefill(m, NCPUPAGE / 2);
+    r = m->freelist;
+    if(r){
+      m->freelist = r->next;
+      m->FreePageNum --;
+    }
+  }
+  putmagazine();
+  if(r == 0)
+    return 0;
+
+  kmem.PhisicalPageRefCount[V2P((char*)r) >> PGSHIFT] = 1;
+  xadd(&PhysicalPageTotal, 1);
+  if(zeroed)
+    r->next = 0;  // the only non-zero word, kzerofill zeroed prev
+  else
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Called by the scheduler when this CPU has nothing to run: zero a
+// few free pages outside the lock and move them to the zeroed pool,
+// until it holds NZEROEDPAGE pages.
+void
+kzerofill(void)
+{
+  struct run *r;
+  int i;
+
+  // Before kinit2() the boot CPU fills the free lists without the lock.
+  if(!kmem.use_lock)
+    return;
+  for(i = 0; i < 8; i++){
+    acquire(&kmem.lock);
+    if(kmem.ZeroedPageNum >= NZEROEDPAGE || (r = buddyalloc(0)) == 0){
+      release(&kmem.lock);
+      return;
+    }
+    release(&kmem.lock);
+
+    memset(r, 0, PGSIZE);
+
+    acquire(&kmem.lock);
+    r->next = kmem.zeroedlist;
+    kmem.zeroedlist = r;
+    kmem.ZeroedPageNum ++;
+    kmem.FreePageNum ++;
     release(&kmem.lock);
+  }
+}
 
+// Allocate 2^order physically contiguous pages, aligned to their
+// size. Single pages go through kalloc's per-CPU fast path.
+// Returns 0 if there is no free block that large.
+char*
+kallocorder(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kallocorder");
+  if(order == 0)
+    return kalloc();
+  acquire(&kmem.lock);
+  r = buddyalloc(order);
+  release(&kmem.lock);
+  if(r)
+    xadd(&PhysicalPageTotal, 1 << order);
   return (char*)r;
 }
 
+// Free a block returned by kallocorder(order).
+void
+kfreeorder(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) || _physicalAddrInvalid(V2P(v)))
+    panic("kfreeorder");
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  memset(v, 1, PGSIZE << order);
+  acquire(&kmem.lock);
+  buddyfree((struct run*)v, order);
+  release(&kmem.lock);
+  xadd(&PhysicalPageTotal, -(1 << order));
+}
+
 uint getPhysicalPageRefCount(uint physicalAddr) {
   if(_physicalAddrInvalid(physicalAddr))
     panic("physicalAddr overflow in getPhysicalRefCount");
 
-  acquire(&kmem.lock);
   ///////Start getPhysicalRefCount main work.
   uint physicalPageIdx = physicalAddr >> PGSHIFT;
-  uint count = kmem.PhisicalPageRefCount[physicalPageIdx];
+  uint count = ((volatile uint*)kmem.PhisicalPageRefCount)[physicalPageIdx];
   ///////End getPhysicalRefCount main work.
-  release(&kmem.lock);
 
   return count;
 }
@@ -140,12 +473,10 @@ void _modifyPhysicalPageRefCount(uint physicalAddr, uint delta) {
   if(_physicalAddrInvalid(physicalAddr))
     panic("physicalAddr overflow in _modifyPhysicalPageRefCount");
 
-  acquire(&kmem.lock);
   ///////Start modifyPhysicalPageRefCount main work.
   uint physicalPageIdx = physicalAddr >> PGSHIFT;
-  kmem.PhisicalPageRefCount[physicalPageIdx] += delta;
+  xadd((volatile int*)&kmem.PhisicalPageRefCount[physicalPageIdx], (int)delta);
   ///////End modifyPhysicalPageRefCount main work.
-  release(&kmem.lock);
 }
 
 void increasePhysicalPageRefCountByOne(uint physicalAddr) {
@@ -160,3 +491,22 @@ int GetPhysicalPageTotal()
 {
   return PhysicalPageTotal;
 }
+
+// Number of free physical pages, used to decide when to reclaim.
+// Read without the lock: callers only compare it to a watermark.
+int GetFreePageNum()
+{
+  int i, n;
+
+  n = kmem.FreePageNum;
+  for(i = 0; i < NCPU; i++)
+    n += kmagazine[i].FreePageNum + kmagazine[i].ZeroedPageNum;
+  return n;
+}
+
+// Number of free buddy blocks of 2^order pages, for fragmentation
+// statistics. Read without the lock.
+int GetFreeBlockNum(int order)
+{
+  return kmem.FreeBlockNum[order];
+}
@@ -19,6 +19,7 @@ main(void)
 {
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
+  InitZeroPage();  // shared zero page for untouched user memory
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
   seginit();       // segment descriptors
@@ -29,13 +30,17 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  InitializeSwapArea(); // raw swap areas
+  InitializeCompressedSwap(); // compressed swap pool
   fileinit();      // file table
+  pipeinit();      // pipe object cache
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   InitVirtualMemoryData();
   InitGlobalSharedMemory();
   userinit();      // first user process
+  StartPageOutDaemon(); // background page-out thread
   mpmain();        // finish this processor's setup
 }
 
@@ -0,0 +1,33 @@
+// Layout of the buffer filled by the GetMemoryInfo system call.
+// Every field is a big-endian uint; user programs read them with
+// MemoryInfo and ProcessMemoryInfo (ulib.c).
+//
+// The first global fields are the header, one per 4 bytes. One
+// 16-byte record per process follows, then the other global fields
+// from byte (number of processes + 1) * 16 on.
+
+#define MEMORY_INFO_SIZE 1200  // bytes filled by GetMemoryInfo
+
+// Global fields, MemoryInfo(info, MI_...)
+#define MI_PROCESSNUM     0   // processes listed
+#define MI_PHYSICALPAGES  1   // physical pages in use
+#define MI_SHAREDPAGES    2   // shared memory pages
+#define MI_PAGEFAULT      3   // page faults; first field after the records
+#define MI_SWAPIN         4   // pages swapped in
+#define MI_SWAPOUT        5   // pages swapped out
+#define MI_SWAPWRITE      6   // swapped out pages written to swap
+#define MI_MAXORDER       7   // largest buddy block order
+#define MI_FREEBLOCK      8   // free buddy blocks of order 0..MAXORDER,
+                              // 16 slots, so MAXORDER < 16
+#define MI_TABLELENGTH    24  // memory table pages per process
+#define MI_RESIDENTLIMIT  25  // resident pages per process
+#define MI_FAULTAROUND    26  // pages mapped per lazy heap fault
+#define MI_COMPRESSED     27  // 7 compressed swap counters: stored, bytes,
+                              // rejected, hits, misses, written back, in pool
+
+// Per-process fields, ProcessMemoryInfo(info, i, MIP_...) for the
+// i'th record, 0 <= i < MemoryInfo(info, MI_PROCESSNUM)
+#define MIP_PID           0
+#define MIP_MEMORYPAGES   1   // resident pages
+#define MIP_SWAPPAGES     2   // swapped out pages
+#define MIP_SHAREDPAGES   3   // shared memory pages
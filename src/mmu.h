@@ -131,6 +131,9 @@ struct segdesc {
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define LARGEPGSIZE    (PGSIZE*NPTENTRIES)  // bytes mapped by a PTE_PS directory entry
+#define LARGEPGROUNDDOWN(a) (((a)) & ~(LARGEPGSIZE-1))
+
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
@@ -11,4 +11,13 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define SWAPSIZE     16384  // raw swap blocks after the file system
+#define SWAPEXTENTSIZE 128  // blocks per swap extent (16 swap slots of 8 blocks)
+#define NSWAPEXTENT  (SWAPSIZE/SWAPEXTENTSIZE)  // max raw swap extents
+#define NSWAPIO      4  // concurrent raw swap I/O requests
+#define NSWAPBUF     16  // bufs per raw swap I/O request
+#define NZEROEDPAGE   256  // free pages idle CPUs keep zeroed for kalloczeroed
+#define NCPUPAGE       32  // free pages each CPU caches in its kalloc magazine
+#define MAXORDER       10  // largest buddy block is 2^MAXORDER pages (4MB)
+#define NSLABOBJ       16  // free objects each CPU caches per slab cache
 
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
 
 struct {
   struct spinlock lock;
@@ -41,16 +42,19 @@ void InitVirtualMemoryData(void)
     thisproc = &ptable.proc[i];
     thisproc->MemoryEntryNum = 0;
     thisproc->SwapPageNum = 0;
+    thisproc->LargePageNum = 0;
     thisproc->MemoryListHead = 0;
     thisproc->MemoryListTail = 0;
     thisproc->MemoryTableListHead = 0;
     thisproc->MemoryTableListTail = 0;
     thisproc->SwapTableListHead = 0;
     thisproc->SwapTableListTail = 0;
+    thisproc->MemoryFreeListHead = 0;
+    thisproc->AddressIndex = 0;
+    thisproc->VirtualMemoryLocked = 0;
 
-    int j;
-    for (j = 0; j < SWAP_FILE_MAX_NUM; j++)
-      thisproc->FilesForSwap[j] = 0;
+    thisproc->SwapExtentListHead = 0;
+    thisproc->SwapExtentNum = 0;
   }
   release(&ptable.lock);
 }
@@ -58,6 +62,115 @@ void InitVirtualMemoryData(void)
 
 
 
+/*
+描述：获取一个进程的虚拟内存锁，被占用时睡眠等待
+参数：进程
+返回：无
+*/
+void LockVirtualMemory(struct proc *CurrentProcess)
+{
+  acquire(&ptable.lock);
+  while (CurrentProcess->VirtualMemoryLocked)
+  {
+    sleep(&CurrentProcess->VirtualMemoryLocked, &ptable.lock);
+  }
+  CurrentProcess->VirtualMemoryLocked = 1;
+  release(&ptable.lock);
+}
+
+/*
+描述：释放一个进程的虚拟内存锁
+参数：进程
+返回：无
+*/
+void UnlockVirtualMemory(struct proc *CurrentProcess)
+{
+  acquire(&ptable.lock);
+  CurrentProcess->VirtualMemoryLocked = 0;
+  wakeup1(&CurrentProcess->VirtualMemoryLocked);
+  release(&ptable.lock);
+}
+
+/*
+描述：全局页面回收：空闲物理页不足时，在所有进程里选驻留页最多，而且没有在运行，虚拟内存锁空闲的进程，
+用时钟算法换出它的页。选页和修改页表都在持有ptable.lock时完成，这时被选中的进程不会在任何CPU上运行，
+也就没有过期的TLB；之后写交换文件时进程可以继续运行，访问被换出的页会在缺页中断里等待它的虚拟内存锁
+参数：希望回收的页数
+返回：实际回收的页数
+*/
+int ReclaimMemory(int PageNum)
+{
+  struct proc *p, *Victim;
+  struct MemoryTableEntry *Entry;
+  uint PhysicalAddress[RECLAIM_BATCH_SIZE], Slot[RECLAIM_BATCH_SIZE];
+  uint RunSlot;
+  int Reclaimed = 0, BatchNum;
+
+  while (Reclaimed < PageNum)
+  {
+    acquire(&ptable.lock);
+    Victim = 0;
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+      if ((p->state != SLEEPING && p->state != RUNNABLE) || p->VirtualMemoryLocked || !CanSwapOut(p))
+      {
+        continue;
+      }
+      if (Victim == 0 || p->MemoryEntryNum > Victim->MemoryEntryNum)
+      {
+        Victim = p;
+      }
+    }
+    if (Victim == 0)
+    {
+      release(&ptable.lock);
+      break;
+    }
+    Victim->VirtualMemoryLocked = 1;
+    release(&ptable.lock);
+
+    //这一批换出的页尽量用一段连续的空槽，写外存时就是一次顺序写；这段槽没有全部的交换空间时不用它
+    RunSlot = GetEmptySwapRun(Victim, RECLAIM_BATCH_SIZE);
+    if (RunSlot != SWAP_SLOT_NONE && !GrowSwapSpace(Victim, RunSlot + RECLAIM_BATCH_SIZE - 1))
+    {
+      RunSlot = SWAP_SLOT_NONE;
+    }
+
+    acquire(&ptable.lock);
+    if (Victim->state != SLEEPING && Victim->state != RUNNABLE)
+    {
+      release(&ptable.lock);
+      UnlockVirtualMemory(Victim);
+      continue;
+    }
+    for (BatchNum = 0; BatchNum < RECLAIM_BATCH_SIZE && Reclaimed + BatchNum < PageNum && CanSwapOut(Victim); BatchNum++)
+    {
+      Slot[BatchNum] = RunSlot;
+      if ((Entry = DetachVictimPage(Victim, &PhysicalAddress[BatchNum], &Slot[BatchNum])) == 0)
+      {
+        break;
+      }
+      FreeMemoryEntry(Victim, Entry);
+      if (RunSlot != SWAP_SLOT_NONE && Slot[BatchNum] == RunSlot)
+      {
+        RunSlot ++;
+      }
+      Victim->MemoryEntryNum --;
+    }
+    release(&ptable.lock);
+
+    WriteBackVictimPages(Victim, PhysicalAddress, Slot, BatchNum);
+    UnlockVirtualMemory(Victim);
+    Reclaimed += BatchNum;
+    //最大的进程交换空间用完了，回收到此为止
+    if (BatchNum == 0)
+    {
+      break;
+    }
+  }
+  return Reclaimed;
+}
+
 /*
 描述：uint转char函数
 参数:int,char类型头指针
@@ -75,6 +188,16 @@ void IntToChar(uint num, char* ResultList)
   ResultList[3] = Place3;
 }
 
+/*
+描述：写GetMemoryInfo结果里进程信息之后的一个全局字段（见meminfo.h）
+参数：结果数组，进程总数，字段，值
+返回：无
+*/
+static void SetMemoryInfo(char* ResultList, int ProcessNumber, int Field, uint Value)
+{
+  IntToChar(Value, &ResultList[(ProcessNumber + 1) * 16 + (Field - MI_PAGEFAULT) * 4]);
+}
+
 /*
 描述：获取全局和所有进程的内存信息
 参数和返回：result列表：
@@ -85,6 +208,8 @@ void IntToChar(uint num, char* ResultList)
 %4=1元素：进程内存页面数目
 %4=2元素：进程外存页面数目
 %4=3元素：进程共享内存页面数目
+进程信息之后（从第(进程总数+1)*16字节开始）：其余的全局字段，有统计，也有测试程序要用的内核常量，顺序见meminfo.h
+用户程序用MemoryInfo，ProcessMemoryInfo（见ulib.c）读取
 */
 void GetMemoryInfo(char* ResultList)
 {
@@ -108,7 +233,7 @@ void GetMemoryInfo(char* ResultList)
     }
     ProcessNumber ++;
     ProcessID = CurrentProcess->pid;
-    MemoryPageUsed = CurrentProcess->MemoryEntryNum;
+    MemoryPageUsed = CurrentProcess->MemoryEntryNum + CurrentProcess->LargePageNum * NPTENTRIES;
     SwapPageUsed = CurrentProcess->SwapPageNum;
     SharedMemoryPageUsed = GetProcessSharedMemoryInfo(CurrentProcess);
     int Base = ProcessNumber * 16;
@@ -120,6 +245,25 @@ void GetMemoryInfo(char* ResultList)
   IntToChar(ProcessNumber, &ResultList[0]);
   IntToChar(PhysicalMemoryUsed, &ResultList[4]);
   IntToChar(SharedMemoryGlobal, &ResultList[8]);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_PAGEFAULT, VirtualMemoryStat.PageFaultNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_SWAPIN, VirtualMemoryStat.SwapInNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_SWAPOUT, VirtualMemoryStat.SwapOutNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_SWAPWRITE, VirtualMemoryStat.SwapWriteNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_MAXORDER, MAXORDER);
+  for (i = 0; i <= MAXORDER; i++)
+  {
+    SetMemoryInfo(ResultList, ProcessNumber, MI_FREEBLOCK + i, GetFreeBlockNum(i));
+  }
+  SetMemoryInfo(ResultList, ProcessNumber, MI_TABLELENGTH, MEMORY_TABLE_LENGTH);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_RESIDENTLIMIT, MEMORY_RESIDENT_LIMIT);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_FAULTAROUND, FAULT_AROUND_PAGES);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED, VirtualMemoryStat.CompressedStoreNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED + 1, VirtualMemoryStat.CompressedByteNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED + 2, VirtualMemoryStat.CompressedRejectNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED + 3, VirtualMemoryStat.CompressedHitNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED + 4, VirtualMemoryStat.CompressedMissNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED + 5, VirtualMemoryStat.CompressedWritebackNum);
+  SetMemoryInfo(ResultList, ProcessNumber, MI_COMPRESSED + 6, VirtualMemoryStat.CompressedPageNum);
   release(&ptable.lock);
 }
 
@@ -211,18 +355,17 @@ found:
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
 
-  //初始化内存表
-  if (p->MemoryTableListHead == 0)
-  {
-      AllocMemoryTable(p);
-  }
-  else
-  {
-    ClearMemoryTable(p);
-  }
+  //内存表和交换表都是按需分配的，这里只清空上一个进程留下的
+  ClearMemoryTable(p);
+  ClearSwapTable(p);
   p->MemoryEntryNum = 0;
+  p->LargePageNum = 0;
   p->MemoryListHead = 0;
   p->MemoryListTail = 0;
+  p->LastFaultAddress = 0;
+  p->SwapReadAheadWindow = 1;
+  p->SwapInNextAddress = 0;
+  p->VirtualMemoryLocked = 0;
 
   //初始化共享内存
   int i;
@@ -270,6 +413,69 @@ userinit(void)
   release(&ptable.lock);
 }
 
+//换出守护线程，也是它睡眠等待的channel
+static struct proc *PageOutDaemonProcess;
+
+/*
+描述：换出守护线程的主循环。空闲物理页低于低水位时被唤醒，一批一批地回收，
+直到空闲页高于高水位，或者已经没有可以换出的页，然后继续睡眠
+参数：无
+返回：不返回
+*/
+static void PageOutDaemon(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+
+  for (;;)
+  {
+    acquire(&ptable.lock);
+    sleep(PageOutDaemonProcess, &ptable.lock);
+    release(&ptable.lock);
+
+    while (GetFreePageNum() < RECLAIM_HIGH_WATERMARK)
+    {
+      if (ReclaimMemory(RECLAIM_BATCH_SIZE) == 0)
+      {
+        break;
+      }
+    }
+  }
+}
+
+/*
+描述：创建换出守护线程。它是只有内核映射的内核线程，没有用户内存，不会被选为回收对象
+参数：无
+返回：无
+*/
+void StartPageOutDaemon(void)
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("[ERROR] Start page-out daemon failed.");
+  if ((p->pgdir = setupkvm()) == 0)
+    panic("[ERROR] Start page-out daemon failed.");
+  p->context->eip = (uint)PageOutDaemon;
+  safestrcpy(p->name, "kswapd", sizeof(p->name));
+  PageOutDaemonProcess = p;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
+/*
+描述：唤醒换出守护线程，守护线程正在回收时什么都不做
+参数：无
+返回：无
+*/
+void WakePageOutDaemon(void)
+{
+  if (PageOutDaemonProcess != 0)
+    wakeup(PageOutDaemonProcess);
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -281,14 +487,19 @@ growproc(int n)
 
   sz = curproc->sz;
 
+  // Avoid heap grows higher than stack.
   if (sz + n > USERTOP - curproc->stackSize - PGSIZE)
    return -1;
 
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    // Only reserve the address space. Pages are allocated, zeroed and
+    // recorded in the memory table by PageFault on first touch.
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    LockVirtualMemory(curproc);
+    sz = deallocuvm(curproc->pgdir, sz, sz + n);
+    UnlockVirtualMemory(curproc);
+    if(sz == 0)
       return -1;
   }
   curproc->sz = sz;
@@ -312,7 +523,11 @@ fork(void)
   }
 
   // Copy process state from proc.
+  // Hold our virtual memory lock until the memory table has been copied,
+  // so global reclaim cannot page out anything in between.
+  LockVirtualMemory(curproc);
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+    UnlockVirtualMemory(curproc);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -320,6 +535,7 @@ fork(void)
   }
   np->sz = curproc->sz;
   np->stackSize = curproc->stackSize;
+  np->LargePageNum = curproc->LargePageNum;
 
   np->parent = curproc;
   *np->tf = *curproc->tf;
@@ -336,28 +552,14 @@ fork(void)
 
   pid = np->pid;
 
-  //分配交换文件
-  InitializeSwapFiles(np);
-  char buf[PGSIZE / 2] = "";
-  int offset = 0;
-  int nread = 0;
-
-  if (kstrcmp(curproc->name, "init") != 0 && kstrcmp(curproc->name, "sh") != 0)
+  //共享交换空间，不复制交换文件；没有交换空间的进程第一次换出页时才分配（见GrowSwapSpace）
+  //然后复制虚拟内存数据结构
+  if (ShareSwapSpace(np, curproc) != 0 || CopyVirtualMemoryData(np, curproc) == -1)
   {
-    // Copy swap file.
-    offset = 0;
-    nread = 0;
-    while ((nread = ReadSwapFile(curproc, buf, offset, PGSIZE / 2)) != 0)
-    {
-      if (WriteSwapFile(np, buf, offset, nread) == -1)
-        panic("[ERROR] Copying swapfile in fork().");
-      offset += nread;
-    }
-  }
-
-  //复制虚拟内存数据结构
-  if (CopyVirtualMemoryData(np, curproc) == -1)
+    UnlockVirtualMemory(curproc);
     return -1;
+  }
+  UnlockVirtualMemory(curproc);
 
   acquire(&ptable.lock);
 
@@ -389,7 +591,8 @@ exit(void)
     }
   }
 
-  //清理交换文件
+  //清理交换文件，虚拟内存锁不再释放，回收时就不会再选中这个进程
+  LockVirtualMemory(curproc);
   if (ClearSwapFiles(curproc) != 0)
     panic("[ERROR] Remove swap file error.");
 
@@ -452,6 +655,8 @@ wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
+        ClearMemoryTable(p);
+        ClearSwapTable(p);
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -486,6 +691,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -493,10 +699,12 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
+      ran = 1;
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -514,6 +722,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 
+    // Nothing to run: use the idle time to refill the zeroed page pool.
+    if(!ran)
+      kzerofill();
   }
 }
 
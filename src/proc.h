@@ -75,11 +75,27 @@ struct proc {
   //内存链表
   struct MemoryTableEntry* MemoryListHead;
   struct MemoryTableEntry* MemoryListTail;
+  //空闲entry链表，用空闲entry自己的Next，Last指针串起来
+  struct MemoryTableEntry* MemoryFreeListHead;
+  //虚拟地址索引
+  struct AddressIndex* AddressIndex;
   //计数
   int MemoryEntryNum;
   int SwapPageNum;
+  //4MB大页数，大页不在内存表里（见MapLargePage）
+  int LargePageNum;
+  //上次懒分配缺页（含预映射）的地址，用来判断访问方向，见FaultAround
+  uint LastFaultAddress;
+  //换入预读：预读窗口（页数）和上次换入（含预读）之后的下一页地址，见SwapReadAhead
+  int SwapReadAheadWindow;
+  uint SwapInNextAddress;
+  //虚拟内存锁：进程自己修改内存表，交换表，页表时持有，全局回收时其他进程也会持有（见ReclaimMemory）
+  //由ptable.lock保护
+  int VirtualMemoryLocked;
 
-  struct file *FilesForSwap[SWAP_FILE_MAX_NUM]; // Swap file for memory.
+  //交换区段表：按需分配的页串成的链表，见GrowSwapSpace
+  struct SwapExtentPage *SwapExtentListHead;
+  int SwapExtentNum;
 
   //共享内存
   int SelfSharedMemory[SHARED_MEMORY_PER_PROC];
@@ -0,0 +1,167 @@
+// Object caches for kernel objects smaller than a page.
+//
+// A cache hands out objects of one size, carved out of slab pages
+// taken from kalloc. Each slab page starts with a struct slab and
+// keeps its free objects on a list linked through their first word.
+// Freed objects are not reinitialized, so callers must set every
+// field they use. Each CPU keeps a magazine of free objects per
+// cache: kmemcachealloc and kmemcachefree normally only touch the
+// magazine, and move NSLABOBJ/2 objects at a time between it and the
+// slab pages under the cache lock when it runs empty or full.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct kmemcache *cache;
+  struct slab *next;     // on cache->partial
+  struct slab *prev;
+  void *freelist;        // free objects in this page
+  int inuse;             // objects handed out, magazines included
+};
+
+void
+kmemcacheinit(struct kmemcache *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / c->size;
+  if(c->perslab < 2)
+    panic("kmemcacheinit");
+  c->partial = 0;
+  c->SlabNum = 0;
+  memset(c->magazine, 0, sizeof(c->magazine));
+}
+
+// The slab functions below are called with c->lock held.
+static void
+slablink(struct kmemcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+slabunlink(struct kmemcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take a new page from kalloc and put all its objects on its free list.
+static struct slab*
+slabgrow(struct kmemcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->freelist = 0;
+  s->inuse = 0;
+  obj = (char*)s + PGSIZE - c->perslab * c->size;
+  for(i = 0; i < c->perslab; i++, obj += c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  slablink(c, s);
+  c->SlabNum++;
+  return s;
+}
+
+// Move objects from the slab pages to this CPU's magazine until it
+// holds n.
+static void
+slabrefill(struct kmemcache *c, int cpu, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(c->magazine[cpu].n < n){
+    if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+      break;
+    obj = s->freelist;
+    s->freelist = *(void**)obj;
+    s->inuse++;
+    if(s->freelist == 0)
+      slabunlink(c, s);
+    c->magazine[cpu].obj[c->magazine[cpu].n++] = obj;
+  }
+  release(&c->lock);
+}
+
+// Give n objects from this CPU's magazine back to their slab pages,
+// returning pages that become empty to kalloc.
+static void
+slabdrain(struct kmemcache *c, int cpu, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  for(; n > 0 && c->magazine[cpu].n > 0; n--){
+    obj = c->magazine[cpu].obj[--c->magazine[cpu].n];
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    if(s->freelist == 0)
+      slablink(c, s);
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+    if(--s->inuse == 0){
+      slabunlink(c, s);
+      c->SlabNum--;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate one object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmemcachealloc(struct kmemcache *c)
+{
+  void *obj;
+  int cpu;
+
+  pushcli();
+  cpu = cpuid();
+  if(c->magazine[cpu].n == 0)
+    slabrefill(c, cpu, NSLABOBJ / 2);
+  obj = 0;
+  if(c->magazine[cpu].n > 0)
+    obj = c->magazine[cpu].obj[--c->magazine[cpu].n];
+  popcli();
+  return obj;
+}
+
+// Free an object returned by kmemcachealloc(c).
+void
+kmemcachefree(struct kmemcache *c, void *obj)
+{
+  int cpu;
+
+  if(((struct slab*)PGROUNDDOWN((uint)obj))->cache != c)
+    panic("kmemcachefree");
+  pushcli();
+  cpu = cpuid();
+  if(c->magazine[cpu].n == NSLABOBJ)
+    slabdrain(c, cpu, NSLABOBJ / 2);
+  c->magazine[cpu].obj[c->magazine[cpu].n++] = obj;
+  popcli();
+}
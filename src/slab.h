@@ -0,0 +1,15 @@
+// Object cache for kernel objects smaller than a page, see slab.c.
+struct kmemcache {
+  struct spinlock lock;  // protects partial and SlabNum
+  char *name;            // Name of cache, for debugging.
+  uint size;             // object size, rounded up to 8 bytes
+  int perslab;           // objects that fit in one slab page
+  struct slab *partial;  // slab pages with at least one free object
+  int SlabNum;           // slab pages taken from kalloc
+
+  // Free objects cached by each CPU; used with interrupts off.
+  struct {
+    void *obj[NSLABOBJ];
+    int n;
+  } magazine[NCPU];
+};
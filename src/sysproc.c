@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "meminfo.h"
 
 int
 sys_fork(void)
@@ -54,12 +55,6 @@ sys_sbrk(void)
   addr = curproc->sz;
   if(growproc(n) < 0)
     return -1;
-
-  // Avoid heap grows higher than stack.
-  if (curproc->sz + n > USERTOP - curproc->stackSize - PGSIZE)
-    return -1;
-
-  curproc->sz += n;
   return addr;
 }
 
@@ -131,12 +126,20 @@ int sys_WriteSharedMemory(void)
   return WriteSharedMemory(sig, content);
 }
 
+// GetMemoryInfo fills a kernel page under ptable.lock, which is then
+// copied out with no lock held, since touching the user buffer may
+// fault and sleep.
 int sys_GetMemoryInfo(void)
 {
-  char* result;
-  if (argstr(0, &result) < 0)
+  char *result, *info;
+  if (argptr(0, &result, MEMORY_INFO_SIZE) < 0)
+    return -1;
+  if ((info = kalloc()) == 0)
     return -1;
-  GetMemoryInfo(result);
+  memset(info, 0, MEMORY_INFO_SIZE);
+  GetMemoryInfo(info);
+  memmove(result, info, MEMORY_INFO_SIZE);
+  kfree(info);
   return 0;
 }
 
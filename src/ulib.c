@@ -2,6 +2,7 @@
 #include "stat.h"
 #include "fcntl.h"
 #include "user.h"
+#include "meminfo.h"
 #include "x86.h"
 
 char*
@@ -103,3 +104,46 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Big-endian uint at byte off of a GetMemoryInfo buffer.
+static uint
+meminfoint(char *info, int off)
+{
+  uchar *p;
+
+  p = (uchar*)info + off;
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Global field of a GetMemoryInfo buffer (MI_ in meminfo.h).
+uint
+MemoryInfo(char *info, int field)
+{
+  if(field < MI_PAGEFAULT)
+    return meminfoint(info, field*4);
+  return meminfoint(info, (meminfoint(info, 0) + 1)*16 + (field - MI_PAGEFAULT)*4);
+}
+
+// Index of process pid's record in a GetMemoryInfo buffer,
+// -1 if the process is not listed.
+int
+FindProcessMemoryInfo(char *info, int pid)
+{
+  int i, n;
+
+  n = meminfoint(info, 0);
+  for(i = 0; i < n; i++)
+    if(meminfoint(info, (i+1)*16) == pid)
+      return i;
+  return -1;
+}
+
+// Field of the index'th process record (MIP_ in meminfo.h),
+// -1 if there is no such record.
+int
+ProcessMemoryInfo(char *info, int index, int field)
+{
+  if(index < 0 || index >= meminfoint(info, 0))
+    return -1;
+  return meminfoint(info, (index+1)*16 + field*4);
+}
@@ -42,5 +42,8 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+uint MemoryInfo(char*, int);
+int FindProcessMemoryInfo(char*, int);
+int ProcessMemoryInfo(char*, int, int);
 
 
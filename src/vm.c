@@ -41,13 +41,18 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS){
+    // Mapped by a 4MB page, there is no page table to walk.
+    if(alloc)
+      panic("walkpgdir: large page");
+    return 0;
+  }
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloczeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -123,9 +128,8 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloczeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -188,8 +192,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloczeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -260,18 +263,35 @@ pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *cpte;
   uint pa, i;
 
   if((d = setupkvm()) == 0)
     return 0;
 
   // Copy text, data and heap section.
+  // Heap pages that were never touched are not mapped yet, skip them.
+  // 4MB pages are shared copy on write as a whole.
+  // Swapped out pages keep their PTE, the child shares the swap slot
+  // (see ShareSwapSpace).
   for(i = PGSIZE; i < sz; i += PGSIZE) {
+    if(pgdir[PDX(i)] & PTE_PS) {
+      pgdir[PDX(i)] &= ~PTE_W;
+      d[PDX(i)] = pgdir[PDX(i)];
+      increasePhysicalPageRefCountByOne(PTE_ADDR(pgdir[PDX(i)]));
+      i = LARGEPGROUNDDOWN(i) + LARGEPGSIZE - PGSIZE;
+      continue;
+    }
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(!(*pte & (PTE_P | PTE_PG)))
+      continue;
+    if(!(*pte & PTE_P)){
+      if((cpte = walkpgdir(d, (void *) i, 1)) == 0)
+        goto bad;
+      *cpte = *pte;
+      continue;
+    }
     *pte &= ~PTE_W;
     pa = PTE_ADDR(*pte);
     if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
@@ -283,8 +303,14 @@ copyuvm(pde_t *pgdir, uint sz)
   for(i = USERTOP - myproc()->stackSize; i<USERTOP; i+=PGSIZE) {
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    if(!(*pte & PTE_P)){
+      if(!(*pte & PTE_PG))
+        panic("copyuvm: page not present");
+      if((cpte = walkpgdir(d, (void *) i, 1)) == 0)
+        goto bad;
+      *cpte = *pte;
+      continue;
+    }
     *pte &= ~PTE_W;
     pa = PTE_ADDR(*pte);
     if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
@@ -348,98 +374,253 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 //以下是实现虚拟页式存储，修改的函数（allocuvm，deallocuvm，缺页中断）和辅助函数
 //用到了VirtualMemory.c的函数
 
+//全局共享的只读零页：读还没写过的堆和bss页时映射它，第一次写时通过写时复制分配私有页。
+//零页不记录在内存表里，不参与置换；它自己持有一个引用，所以永远不会被kfree释放
+char *ZeroPage;
+
+/*
+描述：分配并清零共享零页
+参数：无
+返回：无
+*/
+void InitZeroPage(void)
+{
+	if ((ZeroPage = kalloczeroed()) == 0)
+	{
+		panic("[ERROR] Alloc zero page failed.");
+	}
+}
+
 /*
-描述：在内存表里记录一块新内存
+描述：在内存表里记录一块新内存，entry从空闲链表里取，常数时间
 参数：虚拟地址，当前进程
+返回：成功0，内存表已满-1
+*/
+int RecordInMemory(char *TheVirtualAddress, struct proc *CurrentProcess)
+{
+	struct MemoryTableEntry* TheEntry = GetFreeMemoryEntry(CurrentProcess);
+	if (TheEntry == 0)
+	{
+		return -1;
+	}
+	TheEntry->VirtualAddress = TheVirtualAddress;
+	TheEntry->SwapSlot = SWAP_SLOT_NONE;
+	TheEntry->Last = 0;
+	TheEntry->Next = CurrentProcess->MemoryListHead;
+	AddToMemoryIndex(CurrentProcess, TheEntry);
+	if (CurrentProcess->MemoryListHead == 0)
+	{
+		CurrentProcess->MemoryListTail = TheEntry;
+	}
+	else
+	{
+		CurrentProcess->MemoryListHead->Last = TheEntry;
+	}
+	CurrentProcess->MemoryListHead = TheEntry;
+	return 0;
+}
+
+/*
+描述：时钟（二次机会）置换：从内存链表尾（时钟指针）开始扫描，
+访问位PTE_A为1的页清除访问位后移到链表头，遇到访问位为0的页就把它选为被换出的页。
+清除的访问位要等调用者最后刷新TLB之后才生效
+参数：当前进程
+返回：被换出的内存entry（已经移出链表）
+*/
+struct MemoryTableEntry* GetClockVictim(struct proc *CurrentProcess)
+{
+	struct MemoryTableEntry* Victim;
+	pte_t* PageTablePlace;
+	int ScanNum = 0;
+
+	//转一整圈之后所有访问位都被清除了，所以最多扫描MemoryEntryNum + 1次
+	for (;;)
+	{
+		Victim = GetMemoryListTail(CurrentProcess);
+		PageTablePlace = walkpgdir(CurrentProcess->pgdir, (void *)Victim->VirtualAddress, 0);
+		if (PageTablePlace == 0 || !(*PageTablePlace & PTE_P) || !(*PageTablePlace & PTE_A) || ScanNum > CurrentProcess->MemoryEntryNum)
+		{
+			return Victim;
+		}
+		*PageTablePlace &= ~PTE_A;
+		SetMemoryListHead(CurrentProcess, Victim, Victim->VirtualAddress);
+		ScanNum ++;
+	}
+}
+
+/*
+描述：给换出的页找一个有交换空间的空槽：优先用调用者希望用的槽，交换空间满了就从最冷的页开始一个一个地丢弃交换缓存，
+直到找到的空槽有交换空间。增加交换区段不会睡眠，持有ptable.lock时也可以调用
+参数：当前进程，希望用的槽（没有时是SWAP_SLOT_NONE）
+返回：位置和槽号，交换空间用完了位置是0
+*/
+struct SwapTablePlace GetBackedSwapSlot(struct proc *CurrentProcess, uint Slot)
+{
+	struct SwapTablePlace ThePlace;
+	ThePlace.Place = 0;
+	if (Slot != SWAP_SLOT_NONE)
+	{
+		ThePlace = GetEmptySlotInSwapTable(CurrentProcess, Slot);
+	}
+	if (ThePlace.Place == 0)
+	{
+		ThePlace = GetEmptyInSwapTable(CurrentProcess);
+	}
+	while (ThePlace.Place == 0 || !GrowSwapSpace(CurrentProcess, ThePlace.Slot))
+	{
+		if (!DropSwapCache(CurrentProcess))
+		{
+			ThePlace.Place = 0;
+			break;
+		}
+		ThePlace = GetEmptyInSwapTable(CurrentProcess);
+	}
+	return ThePlace;
+}
+
+/*
+描述：用时钟算法选出一页，把页表项改成换出状态。页有交换缓存而且没被写过时直接释放物理页，返回的物理地址是0；
+否则用缓存的槽或者新分配一个槽，但还不写外存，也不释放物理页，由调用者把物理页写到交换槽里再释放。
+调用者要保证这个进程此时没有在运行（或者就是当前进程），可以持有ptable.lock调用。
+被选中的entry移出链表和索引，MemoryEntryNum由调用者维护
+参数：进程，返回物理地址，交换槽号（传入希望使用的空槽，没有时是SWAP_SLOT_NONE；返回实际用的槽）
+返回：被换出的内存entry，交换空间用完了返回0，这时什么都没有换出
+*/
+struct MemoryTableEntry* DetachVictimPage(struct proc *CurrentProcess, uint *PhysicalAddress, uint *Slot)
+{
+	//用时钟算法选出被换出的页
+	struct MemoryTableEntry* Victim = GetClockVictim(CurrentProcess);
+	pte_t* PageTablePlace = walkpgdir(CurrentProcess->pgdir, (void *)Victim->VirtualAddress, 0);
+	if (PageTablePlace == 0 || !(*PageTablePlace & PTE_P))
+	{
+		panic("[ERROR] A record is in memstab but not in pgdir.");
+	}
+	*PhysicalAddress = PTE_ADDR(*PageTablePlace);
+
+	//缓存的槽和fork出来的进程共享时不能覆盖，脏页放弃这个槽另找一个
+	if (Victim->SwapSlot != SWAP_SLOT_NONE && (*PageTablePlace & PTE_D) && IsSwapSlotShared(CurrentProcess, Victim->SwapSlot))
+	{
+		RemoveFromSwapTable(CurrentProcess, Victim->SwapSlot);
+		Victim->SwapSlot = SWAP_SLOT_NONE;
+	}
+
+	//有交换缓存的页继续用原来的槽，干净页不用写外存
+	if (Victim->SwapSlot != SWAP_SLOT_NONE)
+	{
+		*Slot = Victim->SwapSlot;
+		if (!(*PageTablePlace & PTE_D))
+		{
+			kfree(P2V(*PhysicalAddress));
+			*PhysicalAddress = 0;
+		}
+	}
+	else
+	{
+		//调用者给了希望用的槽（一批换出的页分配连续的槽），能用就用它
+		struct SwapTablePlace ThePlace = GetBackedSwapSlot(CurrentProcess, *Slot);
+		if (ThePlace.Place == 0)
+		{
+			//交换空间用完了：被选中的页放回链表头，页表不变
+			SetMemoryListHead(CurrentProcess, Victim, Victim->VirtualAddress);
+			return 0;
+		}
+		SetSwapTableEntry(CurrentProcess, ThePlace.Place, Victim->VirtualAddress);
+		*Slot = ThePlace.Slot;
+	}
+	CurrentProcess->SwapPageNum ++;
+	*PageTablePlace = SWAP_PTE(*Slot);
+	xadd(&VirtualMemoryStat.SwapOutNum, 1);
+
+	//被换出的entry不再对应这个地址，由调用者重新设置
+	RemoveFromMemoryIndex(CurrentProcess, Victim);
+	Victim->VirtualAddress = SLOT_USABLE;
+	Victim->SwapSlot = SWAP_SLOT_NONE;
+	return Victim;
+}
+
+/*
+描述：把DetachVictimPage摘下的一批脏页按交换槽号排序，槽号连续的页一次顺序写出（见WriteSwapPages），
+再释放物理页，干净页什么都不做
+参数：进程，物理地址数组，交换槽号数组，页数（不超过RECLAIM_BATCH_SIZE）
 返回：无
 */
-void RecordInMemory(char *TheVirtualAddress, struct proc *CurrentProcess)
-{                                                                                                                                                                                    
-	int i = 0;
-	struct MemoryTablePage *CurrentPage = CurrentProcess->MemoryTableListHead;
+void WriteBackVictimPages(struct proc *CurrentProcess, uint *PhysicalAddress, uint *Slot, int Num)
+{
+	char *Pages[RECLAIM_BATCH_SIZE];
+	uint Slots[RECLAIM_BATCH_SIZE];
+	int DirtyNum = 0, RunStart, i, j;
 
-	while (CurrentPage != 0)
+	//脏页按槽号插入排序
+	for (i = 0; i < Num; i ++)
 	{
-		for (i = 0; i < MEMORY_TABLE_ENTRY_NUM; i++)
+		if (PhysicalAddress[i] == 0)
+		{
+			continue;
+		}
+		for (j = DirtyNum; j > 0 && Slots[j - 1] > Slot[i]; j --)
+		{
+			Slots[j] = Slots[j - 1];
+			Pages[j] = Pages[j - 1];
+		}
+		Slots[j] = Slot[i];
+		Pages[j] = P2V(PhysicalAddress[i]);
+		DirtyNum ++;
+	}
+
+	//槽号连续的一段一起写
+	for (RunStart = 0; RunStart < DirtyNum; RunStart = i)
+	{
+		for (i = RunStart + 1; i < DirtyNum && Slots[i] == Slots[i - 1] + 1; i ++)
 		{
-			if (CurrentPage->EntryList[i].VirtualAddress == SLOT_USABLE)
-			{
-				CurrentPage->EntryList[i].VirtualAddress = TheVirtualAddress;
-				CurrentPage->EntryList[i].Next = CurrentProcess->MemoryListHead;
-				if (CurrentProcess->MemoryListHead == 0)
-				{
-					CurrentProcess->MemoryListHead = &(CurrentPage->EntryList[i]);
-					CurrentProcess->MemoryListTail = &(CurrentPage->EntryList[i]);
-				}
-				else
-				{
-					struct MemoryTableEntry* OldHead = CurrentProcess->MemoryListHead;
-					CurrentProcess->MemoryListHead->Last = &(CurrentPage->EntryList[i]);
-					CurrentProcess->MemoryListHead = &(CurrentPage->EntryList[i]);
-					(&(CurrentPage->EntryList[i]))->Next = OldHead;
-				}
-				return;
-			}
 		}
-		CurrentPage = CurrentPage -> Next;
+		WriteSwapPages(CurrentProcess, &Pages[RunStart], Slots[RunStart], i - RunStart);
+	}
+	for (i = 0; i < DirtyNum; i ++)
+	{
+		kfree(Pages[i]);
+		xadd(&VirtualMemoryStat.SwapWriteNum, 1);
 	}
-	panic("[ERROR] No free slot in memory.");
 }
 
 /*
 描述：内存满了的时候，把内存优先级最低的地方扔到交换表里
 参数：当前进程
-返回：优先级最低的内存entry指针
+返回：优先级最低的内存entry指针，交换空间用完了返回0
 */
 struct MemoryTableEntry* RecordInSwapTable(struct proc *CurrentProcess)
 {
-	//提取内存链表队尾
-	struct MemoryTableEntry* ListTail = GetMemoryListTail(CurrentProcess);
-
-	//提取交换表空位
-	struct SwapTablePlace ThePlace = GetEmptyInSwapTable(CurrentProcess);
-	struct SwapTableEntry* SwapPlace = ThePlace.Place;
-	int FileOffset = ThePlace.Offset;
-
-	//修改交换表和外存
-	SwapPlace->VirtualAddress = ListTail->VirtualAddress;
-	if (WriteSwapFile(CurrentProcess, (char *)PTE_ADDR(ListTail->VirtualAddress), FileOffset, PGSIZE) == 0)
+	uint PhysicalAddress, Slot = SWAP_SLOT_NONE;
+	struct MemoryTableEntry* Victim = DetachVictimPage(CurrentProcess, &PhysicalAddress, &Slot);
+	if (Victim == 0)
 	{
 		return 0;
 	}
-	pte_t* PageTablePlace;
-
-	//修改对应页表
-	PageTablePlace = walkpgdir(CurrentProcess->pgdir, (void *)ListTail->VirtualAddress, 0);
-	if (!(*PageTablePlace))
-	panic("[ERROR] [fifo_write] PTE empty.");
-	kfree((char *)(P2V_WO(PTE_ADDR(*PageTablePlace))));
-	*PageTablePlace = PTE_W | PTE_U | PTE_PG;
 	lcr3(V2P(CurrentProcess->pgdir));
 
-	return ListTail;
+	//从内核地址写外存，然后释放物理页
+	WriteBackVictimPages(CurrentProcess, &PhysicalAddress, &Slot, 1);
+	return Victim;
 }
 
 /*
-描述：交换内存表内存优先级最低的地方和交换表指定位置
+描述：交换内存表内存优先级最低的地方和交换表指定位置。
+换出的页有交换缓存时用它自己的槽（干净页不写），否则另找一个空槽；先整页写出换出的页（一次日志事务），
+再把要进来的页整页直接读进同一个物理页，不经过缓冲区，要进来的页保留自己的槽作为交换缓存。
+只有交换空间满了的时候，换出的页才用要进来的页的槽，通过缓冲区分4次交换；这个槽和别的进程共享时不能覆盖，什么都不换。
+换出的页的物理页和fork出来的进程共享（写时复制）时不能读进这个物理页，要进来的页读进一个新的物理页，只放掉本进程对共享页的引用
 参数：待进入内存的指针，当前进程
-返回：无
+返回：成功0，交换空间满了而且要进来的页的槽是共享的，或者要新的物理页而内存不足-1，这时换出的页放回链表头，页表不变
 */
-void SwapMemoryAndFile(uint TheVirtualAddress, struct proc *CurrentProcess)
+int SwapMemoryAndFile(uint TheVirtualAddress, struct proc *CurrentProcess)
 {
 	char SwapBuffer[SWAP_BUFFER_SIZE];
 	//memory:当前在内存，要出去的;file：当前在外存，要进来的
 	pte_t *PageTableMemory, *PageTableFile;
+	uint PhysicalAddress, CacheSlot, VictimSlot;
+	char *Memory = 0;
 
-	//获取内存里的，要出去的--链表尾
-	struct MemoryTableEntry* EntryMemory = GetMemoryListTail(CurrentProcess);
-
-	//获取外存里的，要进来的
-	struct SwapTablePlace ThePlace = GetAddressInSwapTable(CurrentProcess, (char *)PTE_ADDR(TheVirtualAddress));
-	struct SwapTableEntry* EntryFile = ThePlace.Place;
-	int FileOffset = ThePlace.Offset;
-
-
+	//获取内存里的，要出去的--时钟算法选出的页
+	struct MemoryTableEntry* EntryMemory = GetClockVictim(CurrentProcess);
 
 	//获取对应页表信息
 	PageTableMemory = walkpgdir(CurrentProcess->pgdir, (void *)EntryMemory->VirtualAddress, 0);
@@ -452,44 +633,332 @@ void SwapMemoryAndFile(uint TheVirtualAddress, struct proc *CurrentProcess)
   {
 	  panic("[ERROR] A record should be in pgdir!");
   }
-	*PageTableFile = PTE_ADDR(*PageTableMemory) | PTE_U | PTE_W | PTE_P;
 
-	//内外存交换
-	int FileNum = 0;
-	for (FileNum = 0; FileNum < 4; FileNum ++)
+	//获取外存里的，要进来的：交换槽号就在页表项里
+	uint Slot = SWAP_PTE_SLOT(*PageTableFile);
+	int FileOffset = Slot * PGSIZE;
+	PhysicalAddress = PTE_ADDR(*PageTableMemory);
+
+	//换出的页的物理页是共享的：要进来的页读进新的物理页，先分配好，失败时什么都没有改
+	if (getPhysicalPageRefCount(PhysicalAddress) > 1 && (Memory = AllocUserPage(0)) == 0)
 	{
-		//swaptable和文件一一对应
-		uint FileStartPlace = FileOffset + (SWAP_BUFFER_SIZE * FileNum);
-		int CurrentWritingOffset = SWAP_BUFFER_SIZE * FileNum;
-		memset(SwapBuffer, 0, SWAP_BUFFER_SIZE);
-		ReadSwapFile(CurrentProcess, SwapBuffer, FileStartPlace, SWAP_BUFFER_SIZE);
-		WriteSwapFile(CurrentProcess, (char *)(P2V_WO(PTE_ADDR(*PageTableMemory)) + CurrentWritingOffset), FileStartPlace, SWAP_BUFFER_SIZE);
-		memmove((void *)(PTE_ADDR(TheVirtualAddress) + CurrentWritingOffset), (void *)SwapBuffer, SWAP_BUFFER_SIZE);
+		SetMemoryListHead(CurrentProcess, EntryMemory, EntryMemory->VirtualAddress);
+		return -1;
 	}
 
-	//更新entry,页表
-	EntryFile->VirtualAddress = EntryMemory->VirtualAddress;
+	//缓存的槽和fork出来的进程共享时不能覆盖，脏页放弃这个槽
+	if (EntryMemory->SwapSlot != SWAP_SLOT_NONE && (*PageTableMemory & PTE_D) && IsSwapSlotShared(CurrentProcess, EntryMemory->SwapSlot))
+	{
+		RemoveFromSwapTable(CurrentProcess, EntryMemory->SwapSlot);
+		EntryMemory->SwapSlot = SWAP_SLOT_NONE;
+	}
+
+	//换出的页没有交换缓存时另找一个空槽，交换空间满了先丢弃别的页的交换缓存
+	VictimSlot = EntryMemory->SwapSlot;
+	if (VictimSlot == SWAP_SLOT_NONE)
+	{
+		struct SwapTablePlace ThePlace = GetBackedSwapSlot(CurrentProcess, SWAP_SLOT_NONE);
+		if (ThePlace.Place != 0)
+		{
+			SetSwapTableEntry(CurrentProcess, ThePlace.Place, EntryMemory->VirtualAddress);
+			VictimSlot = ThePlace.Slot;
+			*PageTableMemory |= PTE_D;
+		}
+	}
+
+	if (VictimSlot != SWAP_SLOT_NONE)
+	{
+		//干净页的槽里已经是它的内容，不用写外存
+		if (*PageTableMemory & PTE_D)
+		{
+			WriteSwapFile(CurrentProcess, P2V(PhysicalAddress), VictimSlot * PGSIZE, PGSIZE);
+			xadd(&VirtualMemoryStat.SwapWriteNum, 1);
+		}
+		ReadSwapFile(CurrentProcess, Memory != 0 ? Memory : P2V(PhysicalAddress), FileOffset, PGSIZE);
+		*PageTableMemory = SWAP_PTE(VictimSlot);
+		CacheSlot = Slot;
+	}
+	else
+	{
+		//交换空间满了：内外存交换，换出的页直接用同一个槽，这个槽不能和别的进程共享
+		if (IsSwapSlotShared(CurrentProcess, Slot))
+		{
+			if (Memory != 0)
+			{
+				kfree(Memory);
+			}
+			SetMemoryListHead(CurrentProcess, EntryMemory, EntryMemory->VirtualAddress);
+			return -1;
+		}
+		int FileNum = 0;
+		if (Memory != 0)
+		{
+			//有新的物理页时不用缓冲区：先读出要进来的页，再写出换出的页
+			ReadSwapFile(CurrentProcess, Memory, FileOffset, PGSIZE);
+			WriteSwapFile(CurrentProcess, P2V(PhysicalAddress), FileOffset, PGSIZE);
+			FileNum = 4;
+		}
+		for (; FileNum < 4; FileNum ++)
+		{
+			//swaptable和文件一一对应
+			uint FileStartPlace = FileOffset + (SWAP_BUFFER_SIZE * FileNum);
+			char *CurrentWritingPlace = (char *)P2V(PhysicalAddress) + SWAP_BUFFER_SIZE * FileNum;
+			memset(SwapBuffer, 0, SWAP_BUFFER_SIZE);
+			ReadSwapFile(CurrentProcess, SwapBuffer, FileStartPlace, SWAP_BUFFER_SIZE);
+			WriteSwapFile(CurrentProcess, CurrentWritingPlace, FileStartPlace, SWAP_BUFFER_SIZE);
+			memmove(CurrentWritingPlace, SwapBuffer, SWAP_BUFFER_SIZE);
+		}
+		SetSwapTableEntry(CurrentProcess, GetSlotInSwapTable(CurrentProcess, Slot), EntryMemory->VirtualAddress);
+		*PageTableMemory = SWAP_PTE(Slot);
+		CacheSlot = SWAP_SLOT_NONE;
+		xadd(&VirtualMemoryStat.SwapWriteNum, 1);
+	}
+
+	//换出的页是共享的物理页时只放掉本进程的引用，要进来的页用新的物理页
+	if (Memory != 0)
+	{
+		kfree(P2V(PhysicalAddress));
+		PhysicalAddress = V2P(Memory);
+	}
+
+	//更新entry,页表，新页表项的脏位是0
+	*PageTableFile = PhysicalAddress | PTE_U | PTE_W | PTE_P;
 	SetMemoryListHead(CurrentProcess, EntryMemory, (char *)PTE_ADDR(TheVirtualAddress));
-	*PageTableMemory = PTE_U | PTE_W | PTE_PG;
+	EntryMemory->SwapSlot = CacheSlot;
+	lcr3(V2P(CurrentProcess->pgdir));
+	xadd(&VirtualMemoryStat.SwapInNum, 1);
+	xadd(&VirtualMemoryStat.SwapOutNum, 1);
+	return 0;
+}
+
+/*
+描述：从交换文件读入一页到新分配的物理页，不换出本进程的页。全局回收换出的页被访问时走这里。
+交换槽不释放，作为这一页的交换缓存
+参数：虚拟地址，当前进程
+返回：成功0，物理内存不足-1
+*/
+int SwapInNewPage(uint TheVirtualAddress, struct proc *CurrentProcess)
+{
+	char *Memory;
+	pte_t *PageTableFile = walkpgdir(CurrentProcess->pgdir, (void *)TheVirtualAddress, 0);
+	uint Slot = SWAP_PTE_SLOT(*PageTableFile);
+
+	if ((Memory = AllocUserPage(0)) == 0)
+	{
+		return -1;
+	}
+	if (RecordPage((char *)TheVirtualAddress) != 0)
+	{
+		kfree(Memory);
+		return -1;
+	}
+	ReadSwapFile(CurrentProcess, Memory, Slot * PGSIZE, PGSIZE);
+	*PageTableFile = V2P(Memory) | PTE_U | PTE_W | PTE_P;
+	CurrentProcess->SwapPageNum --;
+	GetAddressInMemoryTable(CurrentProcess, (char *)TheVirtualAddress)->SwapSlot = Slot;
+	xadd(&VirtualMemoryStat.SwapInNum, 1);
+	return 0;
+}
+
+/*
+描述：堆里一整块对齐的4MB区域第一次被写时，直接映射一个4MB大页，减少页表遍历和TLB项。
+只有整块区域都在堆里，而且还没有映射过任何4KB页（页目录项不存在）时才用大页。
+大页不记录在内存表里，不参与置换，fork之后整页写时复制
+参数：当前进程，虚拟地址
+返回：映射了大页0，不满足条件或者没有空闲大页-1
+*/
+int MapLargePage(struct proc *CurrentProcess, uint TheVirtualAddress)
+{
+	uint Base = LARGEPGROUNDDOWN(TheVirtualAddress);
+	pde_t *PageDirectoryEntry = &CurrentProcess->pgdir[PDX(Base)];
+	char *Memory;
+
+	if (Base == 0 || Base + LARGEPGSIZE > CurrentProcess->sz || (*PageDirectoryEntry & PTE_P))
+	{
+		return -1;
+	}
+	if ((Memory = kalloclarge()) == 0)
+	{
+		return -1;
+	}
+	memset(Memory, 0, LARGEPGSIZE);
+	*PageDirectoryEntry = V2P(Memory) | PTE_P | PTE_W | PTE_U | PTE_PS;
+	CurrentProcess->LargePageNum ++;
+	return 0;
+}
+
+/*
+描述：没有空闲大页时，把要写时复制的大页拆成1024个私有的4KB页，复制内容之后记录在内存表里
+参数：当前进程，虚拟地址
+返回：成功0，内存不足-1
+*/
+int SplitLargePage(struct proc *CurrentProcess, uint TheVirtualAddress)
+{
+	uint Base = LARGEPGROUNDDOWN(TheVirtualAddress);
+	pde_t *PageDirectoryEntry = &CurrentProcess->pgdir[PDX(Base)];
+	char *Source = P2V(PTE_ADDR(*PageDirectoryEntry));
+	pte_t *PageTable;
+	char *Memory;
+	int i;
+
+	if ((PageTable = (pte_t *)kalloczeroed()) == 0)
+	{
+		return -1;
+	}
+	for (i = 0; i < NPTENTRIES; i++)
+	{
+		if ((Memory = AllocUserPage(0)) == 0)
+		{
+			//内存不足，释放已经分配的页
+			while (--i >= 0)
+			{
+				kfree(P2V(PTE_ADDR(PageTable[i])));
+			}
+			kfree((char *)PageTable);
+			return -1;
+		}
+		memmove(Memory, Source + i * PGSIZE, PGSIZE);
+		PageTable[i] = V2P(Memory) | PTE_P | PTE_W | PTE_U;
+	}
+	*PageDirectoryEntry = V2P(PageTable) | PTE_P | PTE_W | PTE_U;
+	kfreelarge(Source);
+	CurrentProcess->LargePageNum --;
 	lcr3(V2P(CurrentProcess->pgdir));
+
+	for (i = 0; i < NPTENTRIES; i++)
+	{
+		if (RecordNewPage((char *)(Base + i * PGSIZE)) != 0)
+		{
+			//交换空间用完了：没记录的页不能留在页表里，调用者会杀死进程
+			for (; i < NPTENTRIES; i++)
+			{
+				kfree(P2V(PTE_ADDR(PageTable[i])));
+				PageTable[i] = 0;
+			}
+			lcr3(V2P(CurrentProcess->pgdir));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+描述：大页的写时复制：只有自己在用时直接恢复写权限，否则复制到一个新的大页，没有空闲大页时拆成4KB页
+参数：当前进程，虚拟地址
+返回：成功0，内存不足-1
+*/
+int LargePageCopyOnWrite(struct proc *CurrentProcess, uint TheVirtualAddress)
+{
+	pde_t *PageDirectoryEntry = &CurrentProcess->pgdir[PDX(TheVirtualAddress)];
+	uint PhysicalAddress = PTE_ADDR(*PageDirectoryEntry);
+	char *Memory;
+
+	if (getPhysicalPageRefCount(PhysicalAddress) == 1)
+	{
+		*PageDirectoryEntry |= PTE_W;
+		return 0;
+	}
+	if ((Memory = kalloclarge()) != 0)
+	{
+		memmove(Memory, P2V(PhysicalAddress), LARGEPGSIZE);
+		*PageDirectoryEntry = V2P(Memory) | PTE_P | PTE_W | PTE_U | PTE_PS;
+		kfreelarge(P2V(PhysicalAddress));
+		return 0;
+	}
+	return SplitLargePage(CurrentProcess, TheVirtualAddress);
+}
+
+/*
+描述：分配一页用户内存，空闲物理页低于低水位时唤醒换出守护线程，自己不等待写外存；
+只有分配失败时才同步回收一批，再试一次。要清零的页优先从预先清零的页池里取
+参数：是否清零
+返回：内核地址，失败返回0
+*/
+char* AllocUserPage(uint WhetherZero)
+{
+	char *Memory;
+	if (GetFreePageNum() < RECLAIM_LOW_WATERMARK)
+	{
+		WakePageOutDaemon();
+	}
+	if ((Memory = WhetherZero ? kalloczeroed() : kalloc()) == 0 && ReclaimMemory(RECLAIM_BATCH_SIZE) > 0)
+	{
+		Memory = WhetherZero ? kalloczeroed() : kalloc();
+	}
+	return Memory;
+}
+
+/*
+描述：判断记录一页新内存之前是否要先换出本进程自己的页：达到驻留上限，
+或者物理页已经用完而全局回收又找不到其他进程的页
+参数：当前进程
+返回：需要1，不需要0
+*/
+int NeedSwapOwnPage(struct proc *CurrentProcess)
+{
+	if (!CanSwapOut(CurrentProcess))
+	{
+		return 0;
+	}
+	if (CurrentProcess->MemoryEntryNum >= MEMORY_RESIDENT_LIMIT)
+	{
+		return 1;
+	}
+	if (GetFreePageNum() > 0 || ReclaimMemory(RECLAIM_BATCH_SIZE) > 0)
+	{
+		return 0;
+	}
+	return 1;
 }
 
 /*
 描述：在内存表记录新分配的虚拟地址
 参数：虚拟地址
-返回：无
+返回：成功0，内存表已满-1
 */
-void RecordPage(char *TheVirtualAddress)
+int RecordPage(char *TheVirtualAddress)
 {
 	struct proc *CurrentProcess= myproc();
-	RecordInMemory(TheVirtualAddress, CurrentProcess);
+	if (RecordInMemory(TheVirtualAddress, CurrentProcess) != 0)
+	{
+		return -1;
+	}
 	CurrentProcess->MemoryEntryNum ++;
+	return 0;
+}
+
+/*
+描述：在内存表里一次记录[起始地址，结束地址)里的所有页，每页常数时间，不换出页
+参数：起始地址（页对齐），结束地址
+返回：成功0，超过内存表容量或者驻留上限-1，这时什么都没有记录
+*/
+int RecordMemoryRange(uint Start, uint End)
+{
+	struct proc *CurrentProcess = myproc();
+	uint a;
+	int PageNum;
+
+	if (End <= Start)
+	{
+		return 0;
+	}
+	PageNum = (End - Start + PGSIZE - 1) / PGSIZE;
+	if (CurrentProcess->MemoryEntryNum + PageNum > MEMORY_TABLE_TOTAL_ENTRYS || CurrentProcess->MemoryEntryNum + PageNum > MEMORY_RESIDENT_LIMIT)
+	{
+		return -1;
+	}
+	for (a = Start; a < End; a += PGSIZE)
+	{
+		RecordInMemory((char *)a, CurrentProcess);
+	}
+	CurrentProcess->MemoryEntryNum += PageNum;
+	return 0;
 }
 
 /*
 描述：把内存优先级最低的东西扔到外存
 参数：无
-返回：被移除的内存页表项
+返回：被移除的内存页表项，交换空间用完了返回0
 */
 struct MemoryTableEntry *RecordFile(void)
 {
@@ -498,6 +967,31 @@ struct MemoryTableEntry *RecordFile(void)
 	return RecordInSwapTable(CurrentProcess);
 }
 
+/*
+描述：在内存表记录当前进程一页新的用户内存，达到驻留上限或者物理内存不足时先换出本进程自己的页，
+腾出的entry直接用来记录新地址。在分配物理页之前调用时，换出释放的物理页可以马上用上
+参数：虚拟地址
+返回：成功0，要换出页但交换空间用完了-1，这时什么都没有记录，调用者要杀死进程
+*/
+int RecordNewPage(char *TheVirtualAddress)
+{
+	struct proc *CurrentProcess = myproc();
+	if (CurrentProcess->MemoryEntryNum >= MEMORY_TABLE_TOTAL_ENTRYS || NeedSwapOwnPage(CurrentProcess))
+	{
+		struct MemoryTableEntry* ListTail = RecordFile();
+		if (ListTail == 0)
+		{
+			return -1;
+		}
+		SetMemoryListHead(CurrentProcess, ListTail, TheVirtualAddress);
+	}
+	else if (RecordPage(TheVirtualAddress) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
 /*
 描述：把一个外存的虚拟地址和内存优先级最低地址交换
 参数：无
@@ -514,14 +1008,156 @@ void SwapPage(uint TheVirtualAddress)
 		CurrentProcess->MemoryEntryNum ++;
 		return;
 	}
-	SwapMemoryAndFile(TheVirtualAddress, CurrentProcess);
+
+	uint Slot = SWAP_PTE_SLOT(*walkpgdir(CurrentProcess->pgdir, (void *)TheVirtualAddress, 0));
+
+	//没到驻留上限而且有空闲物理页，就直接换入，否则和本进程的页交换
+	if (SwapOnePage(TheVirtualAddress, CurrentProcess) != 0)
+	{
+		cprintf("[ERROR] Swapping in failed: Memory out, \"%s\" will be killed.\n", CurrentProcess->name);
+		CurrentProcess->killed = 1;
+		return;
+	}
+	SwapReadAhead(TheVirtualAddress, Slot, CurrentProcess);
+}
+
+/*
+描述：换入一页：没到驻留上限而且有空闲物理页，就直接换入，否则和本进程的页交换
+参数：虚拟地址，当前进程
+返回：成功0，本进程没有能换出的页或者交换空间用完了-1
+*/
+int SwapOnePage(uint TheVirtualAddress, struct proc *CurrentProcess)
+{
+	if (!NeedSwapOwnPage(CurrentProcess) && SwapInNewPage(TheVirtualAddress, CurrentProcess) == 0)
+	{
+		return 0;
+	}
+	if (!CanSwapOut(CurrentProcess))
+	{
+		return -1;
+	}
+	return SwapMemoryAndFile(TheVirtualAddress, CurrentProcess);
+}
+
+/*
+描述：换入预读：缺页换入一页之后，把后面紧挨着的、交换槽也连续的已换出页一起换入，它们在交换文件里也是连续的。
+缺页地址正好是上次换入（含预读）之后的下一页，说明是顺序访问，预读窗口加倍；否则窗口减半，随机访问时不预读。
+预读的页有交换缓存，没用到就被换出时不用写外存。预读只用余量（同CanFaultAround），
+到了驻留上限或者空闲物理页低于低水位就停下，不会为了预读换出本进程的页
+参数：缺页的虚拟地址（已经换入），它原来的交换槽号，当前进程
+返回：无
+*/
+void SwapReadAhead(uint TheVirtualAddress, uint Slot, struct proc *CurrentProcess)
+{
+	uint a;
+	int i;
+	pte_t *PageTableEntry;
+
+	if (TheVirtualAddress == CurrentProcess->SwapInNextAddress)
+	{
+		if (CurrentProcess->SwapReadAheadWindow < SWAP_READ_AHEAD_MAX)
+		{
+			CurrentProcess->SwapReadAheadWindow *= 2;
+		}
+	}
+	else if (CurrentProcess->SwapReadAheadWindow > 1)
+	{
+		CurrentProcess->SwapReadAheadWindow /= 2;
+	}
+
+	a = TheVirtualAddress + PGSIZE;
+	for (i = 1; i < CurrentProcess->SwapReadAheadWindow; i++, a += PGSIZE)
+	{
+		PageTableEntry = walkpgdir(CurrentProcess->pgdir, (void *)a, 0);
+		if (PageTableEntry == 0 || (*PageTableEntry & PTE_P) || !(*PageTableEntry & PTE_PG) || SWAP_PTE_SLOT(*PageTableEntry) != Slot + i || !CanFaultAround(CurrentProcess))
+		{
+			break;
+		}
+		if (SwapInNewPage(a, CurrentProcess) != 0)
+		{
+			break;
+		}
+	}
+	CurrentProcess->SwapInNextAddress = a;
+}
+
+/*
+描述：判断能否预映射一页：驻留页离上限还有余量，而且空闲物理页不低于低水位，这样预映射不会导致换出
+参数：当前进程
+返回：能1，不能0
+*/
+int CanFaultAround(struct proc *CurrentProcess)
+{
+	return CurrentProcess->MemoryEntryNum + 1 < MEMORY_RESIDENT_LIMIT && GetFreePageNum() >= RECLAIM_LOW_WATERMARK;
+}
+
+/*
+描述：缺页预映射（fault-around）：懒分配的堆页第一次被写之后，顺着访问方向把同一个4MB区域里紧挨着的、
+还没有映射的堆页一起分配，清零，映射并记录在内存表里，减少顺序第一次访问大块内存时的缺页次数。
+缺页地址比上次低时向下预映射，否则向上
+参数：当前进程，已经映射好的缺页地址
+返回：无
+*/
+void FaultAround(struct proc *CurrentProcess, uint TheVirtualAddress)
+{
+	uint Step = (TheVirtualAddress < CurrentProcess->LastFaultAddress) ? -PGSIZE : PGSIZE;
+	uint a = TheVirtualAddress;
+	pte_t *PageTableEntry;
+	char *Memory;
+	int i;
+
+	CurrentProcess->LastFaultAddress = TheVirtualAddress;
+	for (i = 1; i < FAULT_AROUND_PAGES; i++)
+	{
+		a += Step;
+		if (a < PGSIZE || a >= CurrentProcess->sz || PDX(a) != PDX(TheVirtualAddress) || !CanFaultAround(CurrentProcess))
+		{
+			break;
+		}
+		PageTableEntry = walkpgdir(CurrentProcess->pgdir, (void *)a, 0);
+		if (PageTableEntry == 0 || *PageTableEntry != 0)
+		{
+			break;
+		}
+		if ((Memory = AllocUserPage(1)) == 0)
+		{
+			break;
+		}
+		if (RecordPage((char *)a) != 0)
+		{
+			kfree(Memory);
+			break;
+		}
+		*PageTableEntry = V2P(Memory) | PTE_P | PTE_W | PTE_U;
+		CurrentProcess->LastFaultAddress = a;
+	}
 }
 
+/*
+描述：缺页中断处理，持有当前进程的虚拟内存锁，这样全局回收不会同时修改这个进程的页表
+参数：错误码
+返回：无
+*/
 void PageFault(uint err_code)
 {
+  // Read cr2 before we may sleep on the lock.
   uint va = rcr2();
   struct proc* curproc = myproc();
 
+  if (curproc == 0)
+  {
+    panic("Pagefault. No process.");
+  }
+  xadd(&VirtualMemoryStat.PageFaultNum, 1);
+  LockVirtualMemory(curproc);
+  HandlePageFault(va, err_code);
+  UnlockVirtualMemory(curproc);
+}
+
+void HandlePageFault(uint va, uint err_code)
+{
+  struct proc* curproc = myproc();
+
   // If the page fault is caused by a non-present page,
   // should be due to lazy allocation or null pointer protection,
   // or stack needing growth, or due to be swapped out.
@@ -531,7 +1167,7 @@ void PageFault(uint err_code)
   {
     // Used by swapping.
     pte_t* pte = &curproc->pgdir[PDX(va)];
-    if(((*pte) & PTE_P) != 0)
+    if(((*pte) & PTE_P) != 0 && ((*pte) & PTE_PS) == 0)
     {
       // If the page is swapped out, swap it in.
       if(((uint*)PTE_ADDR(P2V(*pte)))[PTX(va)] & PTE_PG) 
@@ -560,34 +1196,82 @@ void PageFault(uint err_code)
       if (stackGrowResult == 0) {
         cprintf("[ERROR] Stack growth failed, \"%s\" will be killed.\n", curproc->name);
         curproc->killed = 1;
+        return;
       }
+      // A deep recursion will touch the pages below soon, grow by a batch.
+      int i;
+      for (i = 1; i < FAULT_AROUND_PAGES && CanFaultAround(curproc) && stackGrow(curproc->pgdir); i++)
+        ;
       return;
     }
 
     ////////////////////////Stack auto grow end////////////////////////
 
 
+    ////////////////////////Lazy allocation start////////////////////////
 
-    char *mem = kalloc();
-    if (mem == 0)
+    // sbrk only reserves the address space, so a heap page is
+    // allocated, zeroed and recorded here on first touch.
+    // The page right above the heap is a guard page.
+    if (va >= curproc->sz)
     {
-      cprintf("Lazy allocation failed: Memory out. Killing process.\n");
+      cprintf("[ERROR] Accessing 0x%x out of the heap, \"%s\" will be killed.\n", va, curproc->name);
       curproc->killed = 1;
       return;
     }
 
+    // The first write to an untouched, aligned 4MB heap region
+    // maps a large page for the whole region.
+    if ((err_code & PGFLT_WR) && MapLargePage(curproc, va) == 0)
+    {
+      return;
+    }
+
     // va needs to be rounded down, or two pages will be mapped in mappages().
     va = PGROUNDDOWN(va);
-    memset(mem, 0, PGSIZE);
+
+    // A read only needs zeros: map the shared zero page read-only.
+    // The first write gets a private page through copy on write.
+    if (!(err_code & PGFLT_WR))
+    {
+      if (mappages(curproc->pgdir, (char *)va, PGSIZE, V2P(ZeroPage), PTE_U) < 0)
+      {
+        cprintf("Lazy allocation failed: Memory out (2). Killing process.\n");
+        curproc->killed = 1;
+        return;
+      }
+      increasePhysicalPageRefCountByOne(V2P(ZeroPage));
+      return;
+    }
+
+    if (RecordNewPage((char *)va) != 0)
+    {
+      curproc->killed = 1;
+      return;
+    }
+
+    char *mem = AllocUserPage(1);
+    if (mem == 0)
+    {
+      cprintf("Lazy allocation failed: Memory out. Killing process.\n");
+      RemoveFromMemoryList(curproc, GetAddressInMemoryTable(curproc, (char *)va));
+      curproc->killed = 1;
+      return;
+    }
 
     // The first process use this page can have write permissions,
     // but once forked, copyuvm will set it permission to readonly.
     if (mappages(curproc->pgdir, (char *)va, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0)
     {
       cprintf("Lazy allocation failed: Memory out (2). Killing process.\n");
+      RemoveFromMemoryList(curproc, GetAddressInMemoryTable(curproc, (char *)va));
+      kfree(mem);
       curproc->killed = 1;
       return;
     };
+    FaultAround(curproc, va);
+
+    ////////////////////////Lazy allocation end////////////////////////
   
     return;
   }
@@ -599,6 +1283,19 @@ void PageFault(uint err_code)
     panic("Pagefault. No process.");
   }
 
+  // Copy on write of a 4MB page.
+  if ((va < KERNBASE) && (curproc->pgdir[PDX(va)] & PTE_PS) && !(curproc->pgdir[PDX(va)] & PTE_W))
+  {
+    if (LargePageCopyOnWrite(curproc, va) < 0)
+    {
+      cprintf("[PageFault:copy on write] Cannot alloc new memory. Killed %s(pid %d)\n", curproc->name, curproc->pid);
+      curproc->killed = 1;
+      return;
+    }
+    lcr3(V2P(curproc->pgdir));
+    return;
+  }
+
   if ((va >= KERNBASE) || (pte = walkpgdir(curproc->pgdir, (void *)va, 0)) == 0 || !(*pte & PTE_P) || !(*pte & PTE_U))
   {
     curproc->killed = 1;
@@ -620,6 +1317,28 @@ void PageFault(uint err_code)
       panic("[PageFault] This is not a copy on write pagefault. You must missed handling it above.\n");
     }
     uint pageAddr = PTE_ADDR(*pte);
+
+    // First write to a page that was only read: it has never been
+    // recorded, so record it and give it a private zeroed page.
+    if (pageAddr == V2P(ZeroPage)) {
+      va = PGROUNDDOWN(va);
+      if (RecordNewPage((char *)va) != 0) {
+        curproc->killed = 1;
+        return;
+      }
+      char *newPage = AllocUserPage(1);
+      if(newPage == 0) {
+        cprintf("[PageFault:zero page] Cannot alloc new memory. Killed %s(pid %d)\n", curproc->name, curproc->pid);
+        RemoveFromMemoryList(curproc, GetAddressInMemoryTable(curproc, (char *)va));
+        curproc->killed = 1;
+        return;
+      }
+      *pte = V2P(newPage) | PTE_P | PTE_U | PTE_W;
+      decreasePhysicalPageRefCountByOne(pageAddr);
+      lcr3(V2P(curproc->pgdir));
+      return;
+    }
+
     uint physicalPageRefCount = getPhysicalPageRefCount(pageAddr);
     if (physicalPageRefCount < 1) {
       panic("[PageFault:copy on write] The page isn't used by any process. You make some wrong somewhere else.\n");
@@ -628,7 +1347,7 @@ void PageFault(uint err_code)
     if(physicalPageRefCount == 1) {
       *pte |= PTE_W;
     } else {
-      char *newPage = kalloc();
+      char *newPage = AllocUserPage(0);
       if(newPage == 0) {
         cprintf("[PageFault:copy on write] Cannot alloc new memory. Killed %s(pid %d)\n", curproc->name, curproc->pid);
         curproc->killed = 1;
@@ -636,7 +1355,9 @@ void PageFault(uint err_code)
       }
       memmove(newPage, (char*)P2V(pageAddr), PGSIZE);
       *pte = V2P(newPage) | PTE_P | PTE_U | PTE_W;
-      decreasePhysicalPageRefCountByOne(pageAddr);
+      // The other sharers may have copied it meanwhile: whoever drops
+      // the last reference frees the page.
+      kfree((char*)P2V(pageAddr));
     }
 
     ////////////////////////Copy on write end////////////////////////
@@ -675,27 +1396,20 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
+  // Only exec calls this, building the new image in a fresh pgdir inside
+  // a log transaction, so the whole range is recorded in one pass up
+  // front without paging anything out.
+  if(RecordMemoryRange(a, newsz) != 0)
+    return 0;
   for(; a < newsz; a += PGSIZE)
   {
-    if(CurrentProcess -> MemoryEntryNum >= MEMORY_TABLE_TOTAL_ENTRYS)
-    {
-      struct MemoryTableEntry* ListTail = RecordFile();
-      SetMemoryListHead(CurrentProcess, ListTail, (char*)a);
-    }
-    else
-    {
-      RecordPage((char*)a);
-    }
-    
-    mem = kalloc();
+    mem = kalloczeroed();
     if(mem == 0)
     {
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
     
-    
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       deallocuvm(pgdir, newsz, oldsz);
       kfree(mem);
@@ -705,6 +1419,26 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// exec: map the first page of the new image's user stack. Like
+// allocuvm it records the page without paging anything out, since
+// the process still runs on its old pgdir until exec commits.
+int
+allocustack(pde_t *pgdir)
+{
+  char *mem;
+  uint a = USERTOP - PGSIZE;
+
+  if(RecordMemoryRange(a, USERTOP) != 0)
+    return -1;
+  if((mem = kalloczeroed()) == 0)
+    return -1;
+  if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 
 int stackGrow(pde_t *pgdir) {
   struct proc* curproc = myproc();
@@ -713,24 +1447,23 @@ int stackGrow(pde_t *pgdir) {
   if (heapBorder + PGSIZE > stackBorder) {
     return 0;
   }
-  char* newPageVirtualAddr = kalloc();
+  uint newStackBorder = stackBorder - PGSIZE;
+  // Record the page first: it may have to page out, and fails when
+  // swap space has run out.
+  if (RecordNewPage((char*)newStackBorder) != 0) {
+    return 0;
+  }
+  char* newPageVirtualAddr = AllocUserPage(1);
   if (newPageVirtualAddr == 0) {
+    RemoveFromMemoryList(curproc, GetAddressInMemoryTable(curproc, (char*)newStackBorder));
     return 0;
   }
   uint newPagePhysicalAddr = V2P(newPageVirtualAddr);
-  uint newStackBorder = stackBorder - PGSIZE;
   if (mappages(pgdir, (char*)newStackBorder, PGSIZE, newPagePhysicalAddr, PTE_W|PTE_U) < 0) {
-    deallocuvm(pgdir, newStackBorder, stackBorder);
+    RemoveFromMemoryList(curproc, GetAddressInMemoryTable(curproc, (char*)newStackBorder));
     kfree(newPageVirtualAddr);
     return 0;
   }
-  if (curproc -> MemoryEntryNum >= MEMORY_TABLE_TOTAL_ENTRYS) {
-    struct MemoryTableEntry* ListTail = RecordFile();
-    SetMemoryListHead(curproc, ListTail, (char*)newStackBorder);
-  } else {
-    RecordPage((char*)newStackBorder);
-  }
-  memset(newPageVirtualAddr, 0, PGSIZE);
   curproc->stackSize += PGSIZE;
   return 1;
 }
@@ -738,10 +1471,12 @@ int stackGrow(pde_t *pgdir) {
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or 0 if a 4MB page
+// that is only partly freed could not be split.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
   struct proc* CurrentProcess = myproc();
@@ -750,10 +1485,33 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    // A 4MB page is freed once its whole region is gone. If only the
+    // top of it is, it is split into 4KB pages first (copying it even
+    // if it is shared), and the pages above newsz are freed below, so
+    // they are unmapped: the guard page faults again and a later sbrk
+    // sees zeros. Only the first region can be partial, so failing
+    // here leaves the process unchanged.
+    pde = &pgdir[PDX(a)];
+    if(*pde & PTE_PS)
+    {
+      pa = PTE_ADDR(*pde);
+      if (LARGEPGROUNDDOWN(a) == a)
+      {
+        kfreelarge(P2V(pa));
+        *pde = 0;
+        if (CurrentProcess->pgdir == pgdir)
+          CurrentProcess->LargePageNum --;
+        a = LARGEPGROUNDDOWN(a) + LARGEPGSIZE - PGSIZE;
+        continue;
+      }
+      if (CurrentProcess->pgdir != pgdir || SplitLargePage(CurrentProcess, a) != 0)
+        return 0;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
     {
-      a += (NPTENTRIES - 1) * PGSIZE;
+      // Skip to the end of this page directory entry's region.
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
     }
     //内存中
     else if ((*pte & PTE_P) != 0)
@@ -762,12 +1520,11 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if (pa == 0)
         panic("kfree");
 
-      // If the page is in memstab, clear it.
-      if (CurrentProcess->pgdir == pgdir)
+      // If the page is in memstab, clear it. The zero page never is.
+      if (CurrentProcess->pgdir == pgdir && pa != V2P(ZeroPage))
       {
         struct MemoryTableEntry* CurrentEntry = GetAddressInMemoryTable(CurrentProcess, (char*)a);
         RemoveFromMemoryList(CurrentProcess, CurrentEntry);
-        CurrentProcess -> MemoryEntryNum --;
       }
       char *v = P2V(pa);
       kfree(v);
@@ -776,8 +1533,9 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
     //外存中
     else if ((*pte & PTE_PG) && CurrentProcess->pgdir == pgdir)
     {
-      RemoveFromSwapTable(CurrentProcess, (char*)a);
+      RemoveFromSwapTable(CurrentProcess, SWAP_PTE_SLOT(*pte));
       CurrentProcess -> SwapPageNum --;
+      *pte = 0;
     }
   }
   return newsz;
@@ -130,6 +130,31 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add delta to *addr and return the old value.
+static inline int
+xadd(volatile int *addr, int delta)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (delta), "+m" (*addr) :
+               :
+               "memory", "cc");
+  return delta;
+}
+
+// Atomically set *addr to newval if it still holds oldval.
+// Returns the value *addr held before.
+static inline uint
+cmpxchg(volatile uint *addr, uint oldval, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (oldval) :
+               "memory", "cc");
+  return result;
+}
+
 static inline uint
 rcr2(void)
 {